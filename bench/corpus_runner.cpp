@@ -0,0 +1,344 @@
+#include <terminal.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// runs every .vl script in a corpus directory through Terminal::run_file and compares the results
+// against two baselines
+// instruction and syscall counts don't depend on the machine so their baseline is kept alongside the scripts
+// wall time, instructions per second and peak RSS only mean something on the machine that measured them,
+// so their baseline is kept in a local file that is recorded by the first run on a machine
+// usage: flapjack_corpus [-u] [-t threshold] [-l local_baseline] corpus_dir
+//   -u rewrites both baselines from this run instead of comparing against them
+//   -t sets how far (as a fraction) a result may get worse before it counts as a regression
+//   -l names the local baseline, timings aren't compared without one
+
+#define DEFAULT_THRESHOLD 0.25
+#define TIMED_RUNS 3
+#define BASELINE_FILE "baseline.txt"
+
+struct CorpusResult
+{
+    double wall_ms;
+    std::size_t instructions;
+    double instructions_per_second;
+    long syscalls;
+    long peak_rss_kb;
+};
+
+// the script runs in a child so its peak RSS can be read back from wait4
+// and so exit from '=' or a crash can't take the runner with it
+static pid_t start_script(const std::string& path, int result_fd, bool traced)
+{
+    pid_t p_id = fork();
+    if(p_id != 0)
+    {
+        return p_id;
+    }
+    int null_fd = open("/dev/null", O_RDWR);
+    dup2(null_fd, STDIN_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+    if(traced)
+    {
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        raise(SIGSTOP);
+    }
+    std::size_t executed;
+    {
+        Terminal terminal("flapjack");
+        terminal.run_file(path);
+        executed = terminal.instructions_executed();
+    }
+    write(result_fd, &executed, sizeof(executed));
+    _exit(0);
+}
+
+static bool timed_run(const std::string& path, CorpusResult& result)
+{
+    int pipe_fds[2];
+    if(pipe(pipe_fds) == -1)
+    {
+        return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+    pid_t p_id = start_script(path, pipe_fds[1], false);
+    close(pipe_fds[1]);
+    std::size_t executed = 0;
+    bool read_count = read(pipe_fds[0], &executed, sizeof(executed)) == sizeof(executed);
+    close(pipe_fds[0]);
+    int status;
+    struct rusage usage;
+    wait4(p_id, &status, 0, &usage);
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    result.wall_ms = seconds * 1000;
+    result.instructions = executed;
+    result.instructions_per_second = read_count ? executed / seconds : 0;
+    result.peak_rss_kb = usage.ru_maxrss;
+    return read_count && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// counts the syscalls made by the interpreter itself, programs it launches aren't traced
+static long count_syscalls(const std::string& path)
+{
+    int pipe_fds[2];
+    if(pipe(pipe_fds) == -1)
+    {
+        return -1;
+    }
+    pid_t p_id = start_script(path, pipe_fds[1], true);
+    close(pipe_fds[1]);
+    int status;
+    waitpid(p_id, &status, 0);
+    ptrace(PTRACE_SETOPTIONS, p_id, NULL, PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL);
+    long stops = 0;
+    int signal = 0;
+    while(true)
+    {
+        ptrace(PTRACE_SYSCALL, p_id, NULL, signal);
+        if(waitpid(p_id, &status, 0) == -1 || WIFEXITED(status) || WIFSIGNALED(status))
+        {
+            break;
+        }
+        signal = 0;
+        if(WIFSTOPPED(status))
+        {
+            if(WSTOPSIG(status) == (SIGTRAP | 0x80))
+            {
+                stops++;
+            }
+            else
+            {
+                signal = WSTOPSIG(status);
+            }
+        }
+    }
+    close(pipe_fds[0]);
+    // each syscall stops once on entry and once on exit
+    return stops / 2;
+}
+
+// the shared baseline holds "name instructions syscalls" and the local one "name wall_ms instructions_per_second peak_rss_kb"
+// returns false when the file can't be opened
+static bool read_baseline(const std::string& path, bool local, std::map<std::string, CorpusResult>& baseline)
+{
+    std::ifstream file(path);
+    if(!file.is_open())
+    {
+        return false;
+    }
+    std::string line;
+    while(std::getline(file, line))
+    {
+        if(line.length() == 0 || line[0] == '#')
+        {
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string name;
+        CorpusResult entry = {};
+        bool valid;
+        if(local)
+        {
+            valid = static_cast<bool>(fields >> name >> entry.wall_ms >> entry.instructions_per_second >> entry.peak_rss_kb);
+        }
+        else
+        {
+            valid = static_cast<bool>(fields >> name >> entry.instructions >> entry.syscalls);
+        }
+        if(valid)
+        {
+            baseline[name] = entry;
+        }
+    }
+    return true;
+}
+
+static void write_baseline(const std::string& path, bool local, const std::map<std::string, CorpusResult>& results)
+{
+    std::FILE* file = std::fopen(path.c_str(), "w");
+    if(file == NULL)
+    {
+        std::fprintf(stderr, "Unable to write baseline '%s'\n", path.c_str());
+        std::exit(1);
+    }
+    std::fprintf(file, local ? "# name wall_ms instructions_per_second peak_rss_kb\n" : "# name instructions syscalls\n");
+    for(const auto& [name, result] : results)
+    {
+        if(local)
+        {
+            std::fprintf(file, "%s %.3f %.0f %ld\n", name.c_str(), result.wall_ms, result.instructions_per_second, result.peak_rss_kb);
+        }
+        else
+        {
+            std::fprintf(file, "%s %zu %ld\n", name.c_str(), result.instructions, result.syscalls);
+        }
+    }
+    std::fclose(file);
+}
+
+// returns the names of every measurement held by the baseline that got worse by more than threshold
+static std::vector<std::string> find_regressions(const CorpusResult& result, const CorpusResult& base, bool local, double threshold)
+{
+    std::vector<std::string> regressions;
+    if(local)
+    {
+        if(result.wall_ms > base.wall_ms * (1 + threshold))
+        {
+            regressions.emplace_back("wall_ms");
+        }
+        if(result.instructions_per_second * (1 + threshold) < base.instructions_per_second)
+        {
+            regressions.emplace_back("instructions_per_second");
+        }
+        if(result.peak_rss_kb > base.peak_rss_kb * (1 + threshold))
+        {
+            regressions.emplace_back("peak_rss_kb");
+        }
+    }
+    else
+    {
+        if(result.instructions > base.instructions * (1 + threshold))
+        {
+            regressions.emplace_back("instructions");
+        }
+        if(result.syscalls > base.syscalls * (1 + threshold))
+        {
+            regressions.emplace_back("syscalls");
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, const char* argv[])
+{
+    bool update = false;
+    double threshold = DEFAULT_THRESHOLD;
+    std::string corpus_dir;
+    std::string local_path;
+    for(int i = 1; i < argc; i++)
+    {
+        if(std::strcmp(argv[i], "-u") == 0)
+        {
+            update = true;
+        }
+        else if(std::strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            threshold = std::atof(argv[++i]);
+        }
+        else if(std::strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+        {
+            local_path = argv[++i];
+        }
+        else if(corpus_dir.length() == 0)
+        {
+            corpus_dir = argv[i];
+        }
+        else
+        {
+            corpus_dir = "";
+            break;
+        }
+    }
+    if(corpus_dir.length() == 0)
+    {
+        std::fprintf(stderr, "Usage: %s [-u] [-t threshold] [-l local_baseline] corpus_dir\n", argv[0]);
+        return 1;
+    }
+    std::vector<std::string> scripts;
+    for(const auto& entry : std::filesystem::directory_iterator(corpus_dir))
+    {
+        if(entry.path().extension() == ".vl")
+        {
+            scripts.emplace_back(entry.path().string());
+        }
+    }
+    std::sort(scripts.begin(), scripts.end());
+    std::string baseline_path = corpus_dir + "/" + BASELINE_FILE;
+    std::map<std::string, CorpusResult> baseline;
+    read_baseline(baseline_path, false, baseline);
+    std::map<std::string, CorpusResult> local_baseline;
+    // a machine's first run records its timings rather than comparing them against nothing
+    bool record_local = local_path.length() > 0 && (update || !read_baseline(local_path, true, local_baseline));
+    if(record_local && !update)
+    {
+        std::fprintf(stderr, "Recording local baseline '%s', timings will be compared from the next run\n", local_path.c_str());
+    }
+    std::map<std::string, CorpusResult> results;
+    bool regressed = false;
+    for(const std::string& script : scripts)
+    {
+        std::string name = std::filesystem::path(script).stem().string();
+        CorpusResult best;
+        bool valid = true;
+        // the fastest of several runs is kept to keep scheduling noise out of the comparison
+        for(int i = 0; i < TIMED_RUNS && valid; i++)
+        {
+            CorpusResult result;
+            valid = timed_run(script, result);
+            if(i == 0 || result.wall_ms < best.wall_ms)
+            {
+                best = result;
+            }
+        }
+        best.syscalls = count_syscalls(script);
+        if(!valid)
+        {
+            std::fprintf(stderr, "%s: script did not finish cleanly\n", name.c_str());
+            regressed = true;
+            continue;
+        }
+        results[name] = best;
+        std::printf("{\"name\": \"%s\", \"wall_ms\": %.3f, \"instructions\": %zu, \"instructions_per_second\": %.0f, \"syscalls\": %ld, \"peak_rss_kb\": %ld}\n",
+            name.c_str(), best.wall_ms, best.instructions, best.instructions_per_second, best.syscalls, best.peak_rss_kb);
+        if(update)
+        {
+            continue;
+        }
+        auto base = baseline.find(name);
+        if(base == baseline.end())
+        {
+            std::fprintf(stderr, "%s: no baseline\n", name.c_str());
+        }
+        std::vector<std::string> regressions;
+        if(base != baseline.end())
+        {
+            regressions = find_regressions(best, base->second, false, threshold);
+        }
+        auto local_base = local_baseline.find(name);
+        if(!record_local && local_path.length() > 0 && local_base != local_baseline.end())
+        {
+            std::vector<std::string> local_regressions = find_regressions(best, local_base->second, true, threshold);
+            regressions.insert(regressions.end(), local_regressions.begin(), local_regressions.end());
+        }
+        for(const std::string& field : regressions)
+        {
+            std::fprintf(stderr, "%s: %s regressed by more than %.0f%%\n", name.c_str(), field.c_str(), threshold * 100);
+            regressed = true;
+        }
+    }
+    if(update)
+    {
+        write_baseline(baseline_path, false, results);
+    }
+    if(record_local)
+    {
+        write_baseline(local_path, true, results);
+    }
+    return regressed ? 1 : 0;
+}
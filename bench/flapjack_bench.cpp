@@ -0,0 +1,256 @@
+#include <flapjack_parse.h>
+#include <flapjack_commands.h>
+#include <flapjack_io.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// each result is written as one JSON object per line so runs can be compared with standard tools
+// the interpreter's own output is sent to /dev/null while measuring
+
+struct BenchResult
+{
+    std::string name;
+    std::size_t iterations;
+    double seconds;
+};
+
+static std::vector<BenchResult> results;
+
+template<class F>
+static void run_bench(const std::string& name, std::size_t iterations, F body)
+{
+    auto start = std::chrono::steady_clock::now();
+    body(iterations);
+    auto end = std::chrono::steady_clock::now();
+    results.emplace_back((BenchResult){.name = name, .iterations = iterations, .seconds = std::chrono::duration<double>(end - start).count()});
+}
+
+static void bench_split_line()
+{
+    std::string short_line = "1 2 ;";
+    std::string long_line;
+    for(int i = 0; i < 64; i++)
+    {
+        long_line += std::to_string(i % 10) + " ";
+    }
+    long_line += "#";
+    std::string quoted_line = "1 \"";
+    for(int i = 0; i < 64; i++)
+    {
+        quoted_line += "a\\\"b\\n\\t 'c' ";
+    }
+    quoted_line += "\" :";
+    const std::pair<const char*, const std::string*> lines[] = {
+        {"split_line/short", &short_line},
+        {"split_line/long", &long_line},
+        {"split_line/quoted", &quoted_line},
+    };
+    for(const auto& [name, line] : lines)
+    {
+        run_bench(name, 200000, [&](std::size_t iterations)
+        {
+            std::size_t tokens = 0;
+            for(std::size_t i = 0; i < iterations; i++)
+            {
+                tokens += VarelseParser::split_line(*line).size();
+            }
+            if(tokens == 0)
+            {
+                std::abort();
+            }
+        });
+    }
+}
+
+// a program of setup lines followed by the measured line repeated iterations times
+static void bench_opcode(TerminalIO& terminal, std::string& current_dir, const std::string& name,
+    const std::vector<std::string>& setup, const std::vector<std::string>& body, std::size_t iterations)
+{
+    VarelseParser parser;
+    for(const std::string& line : setup)
+    {
+        parser.add_line(line);
+    }
+    for(std::size_t i = 0; i < iterations; i++)
+    {
+        for(const std::string& line : body)
+        {
+            parser.add_line(line);
+        }
+    }
+    run_bench("parse/" + name, iterations * body.size(), [&](std::size_t)
+    {
+        parser.parse(terminal, current_dir, 0);
+    });
+    terminal.flush();
+}
+
+// every opcode but '=' is measured, running it would exit the benchmark
+// opcodes that launch programs or touch the filesystem run far fewer times so the whole run stays short
+static void bench_parse(TerminalIO& terminal, std::string& current_dir)
+{
+    const std::size_t iterations = 200000;
+    const std::size_t launches = 200;
+    bench_opcode(terminal, current_dir, "move", {"2 \"value\" :"}, {"1 2 ;"}, iterations);
+    bench_opcode(terminal, current_dir, "load", {}, {"1 \"value\" :"}, iterations);
+    bench_opcode(terminal, current_dir, "label", {}, {"\"label\" <"}, iterations);
+    bench_opcode(terminal, current_dir, "jump", {"1 \"next\" :", "2 \"\" :", "\"next\" <"}, {"1 2 >"}, iterations);
+    bench_opcode(terminal, current_dir, "push_pop", {"1 \"value\" :"}, {"1 ^", "2 ."}, iterations);
+    bench_opcode(terminal, current_dir, "peek", {"1 \"value\" :", "1 ^", "3 \"0\" :"}, {"2 3 ,", "2 ,"}, iterations);
+    bench_opcode(terminal, current_dir, "echo", {"1 \"value\" :"}, {"1 1 \\"}, iterations);
+    bench_opcode(terminal, current_dir, "stdout", {"1 \"/dev/null\" :"}, {"1 ]", "]"}, iterations);
+    bench_opcode(terminal, current_dir, "toggle", {}, {"~", "}", "{"}, iterations);
+    bench_opcode(terminal, current_dir, "env", {"1 \"FLAPJACK_BENCH\" :", "2 \"value\" :"}, {"1 2 +", "1 3 /"}, iterations);
+    bench_opcode(terminal, current_dir, "invalid", {}, {"1 ;"}, iterations / 10);
+    bench_opcode(terminal, current_dir, "stdin", {"1 \"/dev/null\" :"}, {"1 (", "("}, iterations);
+    bench_opcode(terminal, current_dir, "stderr", {"1 \"/dev/null\" :"}, {"1 [", "["}, iterations);
+    bench_opcode(terminal, current_dir, "display", {"1 \"value\" :", "1 ^"}, {"-"}, iterations / 10);
+    bench_opcode(terminal, current_dir, "clear", {}, {")"}, iterations);
+    bench_opcode(terminal, current_dir, "env_display", {}, {"?"}, iterations / 100);
+    bench_opcode(terminal, current_dir, "clear_executables", {}, {"$"}, iterations);
+    bench_opcode(terminal, current_dir, "jobs", {}, {"&"}, iterations / 10);
+    bench_opcode(terminal, current_dir, "profile", {}, {"%", "%"}, iterations / 100);
+    bench_opcode(terminal, current_dir, "change_dir", {"1 \"" + current_dir + "\" :"}, {"1 @"}, iterations / 10);
+    bench_opcode(terminal, current_dir, "dir", {}, {"_"}, iterations / 100);
+    bench_opcode(terminal, current_dir, "exec", {"1 \"true\" :"}, {"1 #"}, launches);
+    bench_opcode(terminal, current_dir, "capture", {"1 \"true\" :"}, {"2 1 *"}, launches);
+    bench_opcode(terminal, current_dir, "pipeline", {"1 \"true\" :"}, {"1 | 1 |"}, launches);
+    bench_opcode(terminal, current_dir, "parallel", {"1 \"value\" :", "2 \"2\" :", "3 \"true\" :"}, {"1 1 ^", "2 3 `", "4 4 ."}, launches);
+    char dir_template[] = "/tmp/flapjack-bench-XXXXXX";
+    if(mkdtemp(dir_template) != NULL)
+    {
+        bench_opcode(terminal, current_dir, "walk", {"1 \"" + std::string(dir_template) + "\" :"}, {"1 !"}, launches);
+        rmdir(dir_template);
+    }
+}
+
+static void bench_exec(TerminalIO& terminal)
+{
+    Environment environment(environ);
+    ExecutableCache executables(environment);
+    JobTable jobs;
+    TerminalStream streams = {.stdin_path = "", .stdout_path = "", .stdout_append = false, .stderr_path = "", .stderr_append = false};
+    std::vector<Value> args = {Value("true")};
+    run_bench("exec_process/true", 500, [&](std::size_t iterations)
+    {
+        for(std::size_t i = 0; i < iterations; i++)
+        {
+            exec_process(terminal, environment, executables, jobs, false, args, streams);
+        }
+    });
+}
+
+static void bench_dir(TerminalIO& terminal, const std::string& current_dir)
+{
+    char dir_template[] = "/tmp/flapjack-bench-XXXXXX";
+    if(mkdtemp(dir_template) == NULL)
+    {
+        return;
+    }
+    std::string dir = dir_template;
+    const std::size_t num_files = 20000;
+    for(std::size_t i = 0; i < num_files; i++)
+    {
+        std::string file = dir + "/file-" + std::to_string(i);
+        int fd = open(file.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0600);
+        if(fd != -1)
+        {
+            close(fd);
+        }
+    }
+    std::vector<Value> args = {Value(dir)};
+    run_bench("dir_cmd/20000", 20, [&](std::size_t iterations)
+    {
+        for(std::size_t i = 0; i < iterations; i++)
+        {
+            dir_cmd(terminal, current_dir, args);
+        }
+        terminal.flush();
+    });
+    for(std::size_t i = 0; i < num_files; i++)
+    {
+        unlink((dir + "/file-" + std::to_string(i)).c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+static void bench_print(TerminalIO& terminal)
+{
+    run_bench("print/short", 1000000, [&](std::size_t iterations)
+    {
+        for(std::size_t i = 0; i < iterations; i++)
+        {
+            terminal.print("%s\r\n", "a short line of output");
+        }
+        terminal.flush();
+    });
+    run_bench("print/format", 1000000, [&](std::size_t iterations)
+    {
+        for(std::size_t i = 0; i < iterations; i++)
+        {
+            terminal.print("\t[%zu] '%s'\r\n", i, "value");
+        }
+        terminal.flush();
+    });
+    run_bench("print_error/short", 200000, [&](std::size_t iterations)
+    {
+        for(std::size_t i = 0; i < iterations; i++)
+        {
+            terminal.print_error("%s\r\n", "a short error");
+        }
+        terminal.flush();
+    });
+}
+
+int main(int argc, const char* argv[])
+{
+    if(argc > 2)
+    {
+        std::fprintf(stderr, "Usage: %s [output file]\n", argv[0]);
+        return 1;
+    }
+    std::FILE* output = stdout;
+    if(argc == 2)
+    {
+        output = std::fopen(argv[1], "w");
+        if(output == NULL)
+        {
+            std::fprintf(stderr, "Unable to open '%s'\n", argv[1]);
+            return 1;
+        }
+    }
+    int result_fd = dup(fileno(output));
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if(result_fd == -1 || null_fd == -1)
+    {
+        std::fprintf(stderr, "Unable to redirect output\n");
+        return 1;
+    }
+    std::fflush(output);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+    {
+        TerminalIO terminal;
+        Environment environment(environ);
+        std::string current_dir = update_current_dir(environment, "");
+        bench_split_line();
+        bench_parse(terminal, current_dir);
+        bench_exec(terminal);
+        bench_dir(terminal, current_dir);
+        bench_print(terminal);
+    }
+    std::FILE* result_file = fdopen(result_fd, "w");
+    for(const BenchResult& result : results)
+    {
+        std::fprintf(result_file, "{\"name\": \"%s\", \"iterations\": %zu, \"seconds\": %.9f, \"ns_per_op\": %.3f}\n",
+            result.name.c_str(), result.iterations, result.seconds, result.seconds * 1e9 / result.iterations);
+    }
+    std::fclose(result_file);
+    return 0;
+}
@@ -5,11 +5,22 @@
 #include <vector>
 #include <terminal_streams.h>
 #include <flapjack_io.h>
+#include <flapjack_path.h>
+#include <flapjack_env.h>
+#include <flapjack_jobs.h>
+#include <flapjack_value.h>
+#include <flapjack_walk.h>
 
-std::string update_current_dir(const std::string& current_dir);
-int dir_cmd(TerminalIO& terminal, const std::string& current_dir, const std::vector<std::string>& args);
-int cd_cmd(TerminalIO& terminal, std::string& current_dir, const std::vector<std::string>& args);
-int pwd_cmd(TerminalIO& terminal, const std::string& current_dir, const std::vector<std::string>& args);
-int exec_process(TerminalIO& terminal, bool background, const std::vector<std::string>& args, const TerminalStream& streams);
+std::string update_current_dir(Environment& environment, const std::string& current_dir);
+int dir_cmd(TerminalIO& terminal, const std::string& current_dir, const std::vector<Value>& args);
+int cd_cmd(TerminalIO& terminal, Environment& environment, std::string& current_dir, const std::vector<Value>& args);
+int pwd_cmd(TerminalIO& terminal, const std::string& current_dir, const std::vector<Value>& args);
+int exec_process(TerminalIO& terminal, Environment& environment, ExecutableCache& executables, JobTable& jobs, bool background, const std::vector<Value>& args, const TerminalStream& streams);
+int capture_process(TerminalIO& terminal, Environment& environment, ExecutableCache& executables, JobTable& jobs, const std::vector<Value>& args, const TerminalStream& streams, std::string& output);
+long walk_cmd(TerminalIO& terminal, const std::vector<Value>& args, const TerminalStream& streams, std::vector<std::string>& matches);
+int exec_pipeline(TerminalIO& terminal, Environment& environment, ExecutableCache& executables, JobTable& jobs, bool background, const std::vector<std::vector<Value>>& commands, const TerminalStream& streams);
+// runs args with each of items appended in turn, at most max_jobs at once
+// statuses[i] is the status of the job for items[i] (-1 if it didn't start), returns how many jobs failed
+int exec_parallel(TerminalIO& terminal, Environment& environment, ExecutableCache& executables, JobTable& jobs, std::size_t max_jobs, const std::vector<Value>& args, const std::vector<Value>& items, const TerminalStream& streams, std::vector<int>& statuses);
 
 #endif
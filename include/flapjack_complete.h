@@ -0,0 +1,23 @@
+#ifndef FLAPJACK_COMPLETE_H
+#define FLAPJACK_COMPLETE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <flapjack_path.h>
+#include <flapjack_dir.h>
+
+// completes words typed into ':' literals from programs on PATH and from file paths
+// directory listings are cached and only reread when a directory's mtime changes
+class Completer
+{
+public:
+    Completer(ExecutableCache& executables);
+    // fills matches with every word that word could become, sorted and with directories ending in '/'
+    void complete(const std::string& word, std::vector<std::string>& matches);
+private:
+    ExecutableCache& executables;
+    std::unordered_map<std::string, DirIndex> dirs;
+};
+
+#endif
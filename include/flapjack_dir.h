@@ -0,0 +1,71 @@
+#ifndef FLAPJACK_DIR_H
+#define FLAPJACK_DIR_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+#include <sys/types.h>
+
+struct DirEntry
+{
+    std::size_t name_offset;
+    unsigned char type;
+};
+
+// the parts of statx the long format shows
+struct DirEntryInfo
+{
+    bool valid;
+    mode_t mode;
+    std::uint64_t size;
+    std::int64_t mtime;
+};
+
+// reads a whole directory with large getdents64 calls into one packed name buffer
+// so listing a huge directory doesn't allocate per entry
+class DirListing
+{
+public:
+    DirListing();
+    ~DirListing();
+    DirListing(const DirListing&) = delete;
+    DirListing& operator=(const DirListing&) = delete;
+    bool read(const std::string& path);
+    // as read but path is relative to parent_fd and a symlink at path is never followed
+    // a listing can be read again and again, which keeps the buffer getdents64 fills
+    bool read_at(int parent_fd, const std::string& path);
+    void sort();
+    // fills info() for every entry, batching the statx calls through io_uring when the kernel allows it
+    void stat_entries();
+    std::size_t size() const;
+    const char* name(std::size_t index) const;
+    unsigned char type(std::size_t index) const;
+    const DirEntryInfo& info(std::size_t index) const;
+    // the open directory, for looking up entries whose type() is DT_UNKNOWN
+    int fd() const;
+private:
+    bool read_entries(int fd);
+    void stat_sync(std::size_t start, std::size_t end);
+    int dir_fd;
+    std::vector<char> dents;
+    std::vector<char> names;
+    std::vector<DirEntry> entries;
+    std::vector<DirEntryInfo> infos;
+};
+
+// the sorted names in a directory, kept for completion and reloaded only when the directory's mtime changes
+struct DirIndex
+{
+    bool loaded;
+    struct timespec mtime;
+    std::vector<std::string> names;
+    std::vector<unsigned char> types;
+};
+
+// returns false and empties index if path can't be read
+bool update_dir_index(const std::string& path, DirIndex& index);
+// finds the range of index.names starting with prefix
+void find_prefix(const DirIndex& index, const std::string& prefix, std::size_t& start, std::size_t& end);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef FLAPJACK_ENV_H
+#define FLAPJACK_ENV_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstddef>
+
+// environment variables are owned by the shell rather than kept with setenv, which leaks the old string
+// every time a variable is overwritten
+// programs are started with an envp snapshot which is only rebuilt after a variable changes
+class Environment
+{
+public:
+    Environment(char** initial);
+    // returns false if name can't be a variable name
+    bool set(const std::string& name, const std::string& value);
+    // returns NULL when name isn't set
+    const std::string* get(const std::string& name) const;
+    char* const* envp();
+    const std::unordered_map<std::string, std::string>& entries() const;
+    // changes every time a variable is set so users can tell cheaply whether to look again
+    std::size_t version() const;
+private:
+    std::unordered_map<std::string, std::string> variables;
+    std::vector<std::string> snapshot;
+    std::vector<char*> snapshot_envp;
+    bool snapshot_valid;
+    std::size_t changes;
+};
+
+#endif
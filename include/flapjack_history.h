@@ -0,0 +1,46 @@
+#ifndef FLAPJACK_HISTORY_H
+#define FLAPJACK_HISTORY_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+
+// command history kept in an append-only file, one line per entry
+// the file is mapped at startup so loading costs a scan for newlines rather than a copy of every entry
+// searches use a trigram index of the loaded entries which is built on a background thread
+class History
+{
+public:
+    History();
+    ~History();
+    History(const History&) = delete;
+    History& operator=(const History&) = delete;
+    void load(const std::string& path);
+    void add(const std::string& line);
+    std::size_t size() const;
+    std::string_view entry(std::size_t index) const;
+    // finds the newest entry before index containing query, returns false if there isn't one
+    bool search(std::string_view query, std::size_t before, std::size_t& found);
+private:
+    void build_index(std::vector<std::string_view> loaded_entries);
+    int file;
+    void* mapping;
+    std::size_t mapping_length;
+    std::vector<std::string_view> entries;
+    // entries added this session, a deque so views of them stay valid as more are added
+    std::deque<std::string> added;
+    // trigram to the loaded entries containing it in ascending order, only read once index_ready is set
+    std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> trigrams;
+    std::size_t loaded;
+    std::thread indexer;
+    std::atomic<bool> index_ready;
+    std::atomic<bool> stop_indexing;
+};
+
+#endif
@@ -5,6 +5,10 @@
 #include <termio.h>
 #include <vector>
 #include <cstdio>
+#include <atomic>
+#include <cstdarg>
+#include <flapjack_history.h>
+#include <flapjack_complete.h>
 
 enum class TerminalColour
 {
@@ -28,22 +32,49 @@ enum class TerminalColour
 
 struct Key;
 
+// a run of buffered output destined for a single file descriptor
+struct OutputSegment
+{
+    int fd;
+    std::size_t length;
+};
+
 class TerminalIO
 {
 public:
     TerminalIO();
     ~TerminalIO();
-    std::string get_line(const std::string& prompt, std::vector<std::string>& lines);
+    std::string get_line(const std::string& prompt, History& history, Completer& completer);
     void print(const char* format, ...);
     void print_error(const char* format, ...);
     void enable_raw_mode();
     void disable_raw_mode();
     void set_text_colour(std::FILE* stream, TerminalColour colour);
     void reset_text_colour(std::FILE* stream);
-    bool should_quit();
+    void flush();
+    bool is_interactive() const;
+    // set asynchronously by SIGINT so the interpreter can poll it without a syscall
+    bool should_quit() { return interrupted.load(std::memory_order_relaxed); }
+    void clear_quit();
 private:
+    static void handle_interrupt(int signal);
+    static std::atomic<bool> interrupted;
     Key read_key();
+    bool read_byte(char& c, bool wait);
+    bool input_pending() const;
+    bool reverse_search(History& history, std::string& line, std::size_t& row);
+    bool complete_word(Completer& completer, std::string& line, std::size_t& cursor_pos);
+    void redraw_line(const std::string& line, std::size_t cursor_pos, std::string& drawn, std::size_t& drawn_cursor);
+    void write_output(int fd, const char* data, std::size_t length);
+    void format_output(int fd, const char* format, std::va_list args);
     struct termios original_state;
+    bool interactive;
+    int error_fd;
+    std::vector<char> output;
+    std::vector<OutputSegment> segments;
+    std::vector<char> input;
+    std::size_t input_pos;
+    std::size_t input_length;
 };
 
 #endif
@@ -0,0 +1,44 @@
+#ifndef FLAPJACK_JOBS_H
+#define FLAPJACK_JOBS_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <sys/types.h>
+#include <flapjack_value.h>
+
+struct Job
+{
+    std::size_t id;
+    pid_t pid;
+    int pidfd;
+    std::string command;
+    bool running;
+    int status;
+};
+
+// returns -1 when the kernel doesn't support pidfds
+int open_pidfd(pid_t pid);
+
+// background children are watched through pidfds registered with epoll
+// so they can be reaped without blocking or waiting on unrelated children
+// the parser reaps whenever it starts running and every so often in loops so finished children never pile up
+class JobTable
+{
+public:
+    JobTable();
+    ~JobTable();
+    void add(pid_t pid, const std::vector<Value>& args);
+    void reap();
+    bool has_running() const;
+    void clear_finished();
+    const std::vector<Job>& entries() const;
+private:
+    void finish(Job& job, int status);
+    int epoll_fd;
+    std::vector<Job> jobs;
+    std::size_t next_id;
+    std::size_t num_running;
+};
+
+#endif
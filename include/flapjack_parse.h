@@ -2,26 +2,112 @@
 #define FLAPJACK_PARSE_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <cstddef>
 #include <array>
+#include <unordered_map>
 #include <flapjack_io.h>
 #include <terminal_streams.h>
+#include <flapjack_path.h>
+#include <flapjack_env.h>
+#include <flapjack_jobs.h>
+#include <flapjack_value.h>
+#include <flapjack_stack.h>
+#include <flapjack_profile.h>
 
 #define NUM_REGISTERS 10
 
+enum class OpCode : char
+{
+    NOP = 0,
+    INVALID = 1,
+    UNKNOWN = 2,
+    MOVE = ';',
+    LOAD = ':',
+    LABEL = '<',
+    JUMP = '>',
+    EXEC = '#',
+    CHANGE_DIR = '@',
+    DIR = '_',
+    CLEAR = ')',
+    PRINT = '\\',
+    EXIT = '=',
+    DISPLAY = '-',
+    STDIN = '(',
+    STDOUT = ']',
+    STDOUT_APPEND = '}',
+    STDERR = '[',
+    STDERR_APPEND = '{',
+    BACKGROUND = '~',
+    ENV_DISPLAY = '?',
+    ENV_SET = '+',
+    ENV_GET = '/',
+    PUSH = '^',
+    POP = '.',
+    CLEAR_EXECUTABLES = '$',
+    PIPELINE = '|',
+    JOBS = '&',
+    CAPTURE = '*',
+    PEEK = ',',
+    PROFILE = '%',
+    WALK = '!',
+    PARALLEL = '`',
+};
+
+// a single line of Varelse decoded ahead of execution
+// regs holds the register operands in the order they were written
+// literal indexes the parser's literal pool for ':' and '<' (the error message for UNKNOWN and INVALID and the line for '.')
+// groups holds how many of regs belong to each stage of a '|' pipeline
+// jump_label and jump_target cache the last label a '>' went through and the instruction it leads to (0 when unset)
+struct Instruction
+{
+    OpCode op;
+    std::vector<std::size_t> regs;
+    std::size_t literal;
+    std::vector<std::size_t> groups;
+    Value jump_label;
+    std::size_t jump_target;
+};
+
 class VarelseParser
 {
 public:
     VarelseParser();
-    void parse(TerminalIO& terminal, std::string& current_dir, const std::vector<std::string>& lines, std::size_t ip);
+    void add_line(std::string_view text);
+    bool verify(TerminalIO& terminal, std::size_t start);
+    std::size_t size() const;
+    void parse(TerminalIO& terminal, std::string& current_dir, std::size_t ip);
+    static std::vector<std::string> split_line(std::string_view text);
+    static std::vector<std::string> split_line(std::string_view text, bool& terminated);
+    std::size_t instructions_executed() const;
+    ExecutableCache& executable_cache();
+    Environment& environment();
+    void start_profiling();
+    void report_profile(TerminalIO& terminal);
 private:
-    std::vector<std::string> split_line(const std::string& text);
     bool get_reg_arg(const std::string& index, size_t& arg);
-    bool get_command_args(const std::vector<std::string>& line, std::vector<std::string>& args);
+    void get_command_args(const Instruction& instruction, std::vector<Value>& args);
+    void get_pipeline_args(const Instruction& instruction, std::vector<std::vector<Value>>& commands);
+    Instruction compile_line(std::string_view text);
+    Instruction invalid_line(OpCode op, const std::string& message);
+    std::size_t intern_literal(std::string_view literal);
+    bool find_jump_literal(std::size_t index, std::size_t& literal);
+    bool resolve_jump(Instruction& jump, std::size_t literal);
     TerminalStream streams;
-    std::array<std::string, NUM_REGISTERS> registers;
-    std::vector<std::string> stack;
+    std::array<Value, NUM_REGISTERS> registers;
+    // declared before stack and executables, which read their settings from it
+    Environment env;
+    ValueStack stack;
+    std::vector<Value> literals;
+    std::unordered_map<std::string, std::size_t> literal_ids;
+    std::vector<Instruction> program;
+    std::unordered_map<std::string, std::size_t> labels;
+    ExecutableCache executables;
+    JobTable jobs;
+    Profiler profiler;
+    bool profiling;
+    std::size_t executed;
     bool background;
 };
 #undef NUM_REGISTERS
@@ -0,0 +1,36 @@
+#ifndef FLAPJACK_PATH_H
+#define FLAPJACK_PATH_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <ctime>
+#include <flapjack_dir.h>
+#include <flapjack_env.h>
+
+// remembers where programs were found on PATH so repeated launches skip the access() probes
+// entries are dropped when PATH changes or one of its directories is modified
+class ExecutableCache
+{
+public:
+    ExecutableCache(const Environment& environment);
+    bool resolve(const std::string& name, std::string& path);
+    void clear();
+    const std::unordered_map<std::string, std::string>& entries() const;
+    // adds the names of programs on PATH starting with prefix to names
+    void complete(const std::string& prefix, std::vector<std::string>& names);
+private:
+    void validate();
+    const Environment& environment;
+    // version of environment when PATH was last read
+    std::size_t env_version;
+    std::string path_env;
+    std::vector<std::string> dirs;
+    std::vector<struct timespec> dir_mtimes;
+    std::unordered_map<std::string, std::string> paths;
+    // listings of each directory in dirs for completion, loaded on first use
+    std::vector<DirIndex> dir_indexes;
+    struct timespec last_check;
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef FLAPJACK_PROFILE_H
+#define FLAPJACK_PROFILE_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <flapjack_io.h>
+
+// ns is time spent in the interpreter and program_ns time spent waiting on launched programs
+struct ProfileEntry
+{
+    std::size_t count;
+    std::uint64_t ns;
+    std::uint64_t program_ns;
+};
+
+// counts how often each opcode and line runs and how long it takes
+// time spent in launched programs is kept per program and apart from the interpreter's own time for each opcode and line
+class Profiler
+{
+public:
+    Profiler();
+    static std::uint64_t now();
+    void clear();
+    void record(std::size_t line, char op, std::uint64_t ns);
+    void record_program(const std::string& name, std::uint64_t ns);
+    void report(TerminalIO& terminal);
+private:
+    std::array<ProfileEntry, 256> opcodes;
+    std::vector<ProfileEntry> lines;
+    std::unordered_map<std::string, ProfileEntry> programs;
+    // program time recorded for the instruction currently running, moved out of its total by record
+    std::uint64_t current_program_ns;
+};
+
+#endif
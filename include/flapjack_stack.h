@@ -0,0 +1,56 @@
+#ifndef FLAPJACK_STACK_H
+#define FLAPJACK_STACK_H
+
+#include <vector>
+#include <cstddef>
+#include <sys/types.h>
+#include <flapjack_value.h>
+#include <flapjack_env.h>
+
+struct StackChunk
+{
+    std::vector<Value> values;
+    std::size_t count;
+    std::size_t bytes;
+    bool spilled;
+    off_t offset;
+    std::size_t file_length;
+};
+
+// the Varelse stack, kept as fixed size chunks
+// once the values held in memory pass FLAPJACK_STACK_LIMIT bytes the oldest chunks are written to an unlinked
+// temporary file in TMPDIR and read back when popping reaches them again
+// both are read from the shell's environment so they can be changed with '+' 
+// chunks are always spilled from the bottom up so the spill file only ever grows or shrinks at its end
+class ValueStack
+{
+public:
+    ValueStack(const Environment& environment);
+    ~ValueStack();
+    void push(const Value& value);
+    void push_many(std::vector<Value>& values);
+    // both fail when there aren't enough values or the values were spilled and can't be read back
+    bool pop(Value& value);
+    bool pop_many(std::size_t count, std::vector<Value>& values);
+    std::size_t size() const;
+    bool peek(std::size_t index, Value& value);
+private:
+    bool spill(StackChunk& chunk);
+    void spill_cold();
+    StackChunk& push_chunk();
+    bool read_chunk(const StackChunk& chunk, std::vector<Value>& values);
+    bool page_in(StackChunk& chunk);
+    std::vector<StackChunk> chunks;
+    std::size_t first_resident;
+    std::size_t num_values;
+    std::size_t resident_bytes;
+    const Environment& environment;
+    // memory_limit is read again whenever the environment's version moves on from limit_version
+    std::size_t memory_limit;
+    std::size_t limit_version;
+    int spill_fd;
+    std::size_t peek_chunk;
+    std::vector<Value> peek_values;
+};
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef FLAPJACK_VALUE_H
+#define FLAPJACK_VALUE_H
+
+#include <string>
+#include <memory>
+#include <cstddef>
+
+// an immutable, reference counted string
+// copying a value only copies the handle so moving data between registers and the stack is O(1)
+class Value
+{
+public:
+    Value();
+    Value(std::string text);
+    Value(const char* text);
+    const std::string& str() const { return *text; }
+    const char* c_str() const { return text->c_str(); }
+    std::size_t length() const { return text->length(); }
+    // true when both are handles to the same string, which is cheaper than comparing contents
+    bool same(const Value& other) const { return text == other.text; }
+private:
+    std::shared_ptr<const std::string> text;
+};
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef FLAPJACK_WALK_H
+#define FLAPJACK_WALK_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <flapjack_io.h>
+
+// walks the tree under root on a pool of threads, each taking directories from its own queue and stealing
+// from the others once it runs dry
+// every path whose final component matches pattern (any path when pattern is empty) is written as a line to
+// out_fd, or added to matches when out_fd is -1, in no particular order
+// Ctrl-C stops the walk, directories not yet read are skipped and what has matched so far is kept
+// returns how many paths matched or -1 when root can't be opened
+long walk_tree(TerminalIO& terminal, const std::string& root, const std::string& pattern, int out_fd, std::vector<std::string>& matches);
+
+#endif
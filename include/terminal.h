@@ -4,6 +4,8 @@
 #include <string>
 #include <flapjack_io.h>
 #include <flapjack_parse.h>
+#include <flapjack_history.h>
+#include <flapjack_complete.h>
 #include <vector>
 
 class Terminal
@@ -12,11 +14,22 @@ public:
     Terminal(const std::string& call_name);
     void run_cmdline();
     void run_file(const std::string& file_name);
+    void run_code(const std::string& code);
+    void run_stream(int fd);
+    // whether Ctrl-C stopped the script
+    bool interrupted();
+    std::size_t instructions_executed() const;
+    void start_profiling();
+    void report_profile();
 private:
+    void add_lines(const char* start, const char* end);
+    void run_verified();
+    void run_stream_lines(std::size_t ip);
     std::string current_dir;
     TerminalIO terminal_io;
     VarelseParser parser;
-    std::vector<std::string> lines;
+    History history;
+    Completer completer;
 };
 
 #endif
@@ -1,49 +1,157 @@
 #include <flapjack_commands.h>
-#include <dirent.h>
+#include <flapjack_dir.h>
 #include <sys/wait.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <cstring>
 #include <unistd.h>
-#include <flapjack_mem.h>
+#include <spawn.h>
+#include <fcntl.h>
 #include <cstdio>
+#include <cerrno>
+#include <algorithm>
+#include <ctime>
+#include <poll.h>
 
-static int perform_dir_cmd(TerminalIO& terminal, const std::string& path)
+#define CAPTURE_INITIAL_SIZE 4096
+#define CAPTURE_LIMIT (64 * 1024 * 1024)
+
+static void format_mode(mode_t mode, char* out)
 {
-    DIR* dir = opendir(path.c_str());
-    if(dir == NULL)
+    if(S_ISDIR(mode))
+    {
+        out[0] = 'd';
+    }
+    else if(S_ISLNK(mode))
+    {
+        out[0] = 'l';
+    }
+    else if(S_ISFIFO(mode))
+    {
+        out[0] = 'p';
+    }
+    else if(S_ISSOCK(mode))
+    {
+        out[0] = 's';
+    }
+    else if(S_ISCHR(mode))
+    {
+        out[0] = 'c';
+    }
+    else if(S_ISBLK(mode))
+    {
+        out[0] = 'b';
+    }
+    else
+    {
+        out[0] = '-';
+    }
+    const char* perms = "rwxrwxrwx";
+    for(int i = 0; i < 9; i++)
+    {
+        out[i + 1] = (mode & (0400 >> i)) ? perms[i] : '-';
+    }
+    out[10] = '\0';
+}
+
+static int perform_dir_cmd(TerminalIO& terminal, const std::string& path, bool sorted, bool long_format)
+{
+    DirListing listing;
+    if(!listing.read(path))
     {
         terminal.print_error("Error opening directory %s\r\n", path.c_str());
         return 1;
     }
-    struct dirent* entry = readdir(dir);
-    while(entry != NULL)
+    if(sorted)
     {
-        if(std::strcmp(entry->d_name, ".") != 0 && std::strcmp(entry->d_name, "..") != 0)
+        listing.sort();
+    }
+    if(!long_format)
+    {
+        for(std::size_t i = 0; i < listing.size(); i++)
         {
-            terminal.print("%s\r\n", entry->d_name);
+            terminal.print("%s\r\n", listing.name(i));
         }
-        entry = readdir(dir);
+        terminal.print("\r\n");
+        return 0;
+    }
+    listing.stat_entries();
+    char mode[11];
+    char mtime[32];
+    // entries in big directories tend to share a modification minute so the formatted time is reused
+    std::time_t mtime_minute = -1;
+    for(std::size_t i = 0; i < listing.size(); i++)
+    {
+        const DirEntryInfo& info = listing.info(i);
+        if(!info.valid)
+        {
+            // the entry vanished or can't be stat'ed, still show it was there
+            terminal.print("?????????? %10s %16s %s\r\n", "?", "?", listing.name(i));
+            continue;
+        }
+        format_mode(info.mode, mode);
+        std::time_t time = info.mtime;
+        if(time / 60 != mtime_minute)
+        {
+            struct tm local;
+            localtime_r(&time, &local);
+            std::strftime(mtime, sizeof(mtime), "%Y-%m-%d %H:%M", &local);
+            mtime_minute = time / 60;
+        }
+        terminal.print("%s %10llu %s %s\r\n", mode, (unsigned long long)info.size, mtime, listing.name(i));
     }
     terminal.print("\r\n");
-    closedir(dir);
     return 0;
 }
 
-int dir_cmd(TerminalIO& terminal, const std::string& current_dir, const std::vector<std::string>& args)
+int dir_cmd(TerminalIO& terminal, const std::string& current_dir, const std::vector<Value>& args)
 {
-    if(args.size() == 0)
+    // leading arguments starting with '-' are options, s sorts by name and l adds mode, size and mtime
+    // "--" ends the options so directories starting with '-' can be listed
+    bool sorted = false;
+    bool long_format = false;
+    std::size_t first_path = 0;
+    for(; first_path < args.size(); first_path++)
+    {
+        const std::string& arg = args[first_path].str();
+        if(arg.length() < 2 || arg[0] != '-')
+        {
+            break;
+        }
+        if(arg == "--")
+        {
+            first_path++;
+            break;
+        }
+        for(std::size_t i = 1; i < arg.length(); i++)
+        {
+            if(arg[i] == 's')
+            {
+                sorted = true;
+            }
+            else if(arg[i] == 'l')
+            {
+                long_format = true;
+            }
+            else
+            {
+                terminal.print_error("Unknown option '%c' for '_'\r\n", arg[i]);
+                return -1;
+            }
+        }
+    }
+    if(first_path == args.size())
     {
-        int ret = perform_dir_cmd(terminal, current_dir);
+        int ret = perform_dir_cmd(terminal, current_dir, sorted, long_format);
         return ret;
     }
     else
     {
         int ret = 0;
-        for(size_t i = 0; i < args.size(); i++)
+        for(size_t i = first_path; i < args.size(); i++)
         {
             terminal.print("%s:\r\n", args[i].c_str());
-            int path_ret = perform_dir_cmd(terminal, args[i]);
+            int path_ret = perform_dir_cmd(terminal, args[i].str(), sorted, long_format);
             if(path_ret != 0)
             {
                 ret = -1;
@@ -54,7 +162,7 @@ int dir_cmd(TerminalIO& terminal, const std::string& current_dir, const std::vec
 }
 
 
-std::string update_current_dir(const std::string& current_dir)
+std::string update_current_dir(Environment& environment, const std::string& current_dir)
 {
     char* dir = getcwd(NULL, 0);
     if(dir == NULL)
@@ -62,38 +170,38 @@ std::string update_current_dir(const std::string& current_dir)
         // on error, assume we stayed in the original directory
         return current_dir;
     }
-    setenv("PWD", dir, true);
+    environment.set("PWD", dir);
     if(current_dir.length() > 0)
     {
-        setenv("OLDPWD", current_dir.c_str(), true);
+        environment.set("OLDPWD", current_dir);
     }
     std::string res = dir;
     free(dir); // dir is malloced
     return res;
 }
 
-int cd_cmd(TerminalIO& terminal, std::string& current_dir, const std::vector<std::string>& args)
+int cd_cmd(TerminalIO& terminal, Environment& environment, std::string& current_dir, const std::vector<Value>& args)
 {
     if(args.size() == 0)
     {
-        const char* home = getenv("HOME");
+        const std::string* home = environment.get("HOME");
         if(home == NULL)
         {
             terminal.print_error("Error getting home directory\r\n");
             return -1;
         }
-        int value = chdir(home);
-        current_dir = update_current_dir(current_dir);
+        int value = chdir(home->c_str());
+        current_dir = update_current_dir(environment, current_dir);
         if(value != 0)
         {
-            terminal.print_error("Error opening directory %s\r\n", home);
+            terminal.print_error("Error opening directory %s\r\n", home->c_str());
         }
         return value;
     }
     else if(args.size() == 1)
     {
         int value = chdir(args[0].c_str());
-        update_current_dir(current_dir);
+        current_dir = update_current_dir(environment, current_dir);
         if(value != 0)
         {
             terminal.print_error("Error opening directory %s\r\n", args[0].c_str());
@@ -107,7 +215,7 @@ int cd_cmd(TerminalIO& terminal, std::string& current_dir, const std::vector<std
     }
 }
 
-int pwd_cmd(TerminalIO& terminal, const std::string& current_dir, const std::vector<std::string>& args)
+int pwd_cmd(TerminalIO& terminal, const std::string& current_dir, const std::vector<Value>& args)
 {
     if(args.size() == 0)
     {
@@ -121,204 +229,392 @@ int pwd_cmd(TerminalIO& terminal, const std::string& current_dir, const std::vec
     }
 }
 
-char** get_argument_list(const std::vector<std::string>& args)
+// matches are streamed to the stdout redirection when one is set instead of being returned
+long walk_cmd(TerminalIO& terminal, const std::vector<Value>& args, const TerminalStream& streams, std::vector<std::string>& matches)
+{
+    const std::string pattern = args.size() > 1 ? args[1].str() : "";
+    if(streams.stdout_path.length() == 0)
+    {
+        return walk_tree(terminal, args[0].str(), pattern, -1, matches);
+    }
+    int stdout_mode = streams.stdout_append ? O_APPEND : O_TRUNC;
+    int out_fd = open(streams.stdout_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | stdout_mode, 0666);
+    if(out_fd < 0)
+    {
+        terminal.print_error("Error opening %s\r\n", streams.stdout_path.c_str());
+        return -1;
+    }
+    long count = walk_tree(terminal, args[0].str(), pattern, out_fd, matches);
+    close(out_fd);
+    return count;
+}
+
+// redirections are applied in the child by posix_spawn rather than by code we run after forking
+static bool add_redirect(posix_spawn_file_actions_t& actions, int fd, const std::string& path, int flags)
+{
+    if(path.length() == 0)
+    {
+        return true;
+    }
+    return posix_spawn_file_actions_addopen(&actions, fd, path.c_str(), flags, 0666) == 0;
+}
+
+static bool find_program(TerminalIO& terminal, ExecutableCache& executables, const std::string& name, std::string& path)
+{
+    bool found;
+    if(name.length() == 0)
+    {
+        found = false;
+    }
+    else if(name.find('/') != std::string::npos)
+    {
+        path = name;
+        found = access(path.c_str(), X_OK) == 0;
+    }
+    else
+    {
+        found = executables.resolve(name, path);
+    }
+    if(!found)
+    {
+        terminal.print_error("Unknown command '%s'\r\n", name.c_str());
+    }
+    return found;
+}
+
+// starts a program with its stdin and stdout taken from in_fd and out_fd when they aren't -1
+// and from the stream redirections otherwise
+static bool spawn_program(TerminalIO& terminal, Environment& environment, const std::string& path, const std::vector<Value>& args, const TerminalStream& streams, int in_fd, int out_fd, pid_t& p_id)
 {
-   char** arguments = allocate_array<char*>(args.size() + 1);
-   for(size_t i = 0; i < args.size(); i++)
-   {
-       arguments[i] = allocate_array<char>(args[i].length() + 1);
-       std::memcpy(arguments[i], args[i].c_str(), sizeof(char) * args[i].length());
-       arguments[i][args[i].length()] = 0;
-   }
-   arguments[args.size()] = NULL;
-   return arguments;
+    // posix_spawn doesn't write to argv so the strings can be passed without copying
+    std::vector<char*> arguments;
+    arguments.reserve(args.size() + 1);
+    for(const Value& arg : args)
+    {
+        arguments.emplace_back(const_cast<char*>(arg.c_str()));
+    }
+    arguments.emplace_back(nullptr);
+    posix_spawn_file_actions_t actions;
+    if(posix_spawn_file_actions_init(&actions) != 0)
+    {
+        terminal.print_error("Unable to create new processes\r\n");
+        return false;
+    }
+    int stdout_mode = streams.stdout_append ? O_APPEND : O_TRUNC;
+    int stderr_mode = streams.stderr_append ? O_APPEND : O_TRUNC;
+    bool actions_valid;
+    if(in_fd != -1)
+    {
+        actions_valid = posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO) == 0;
+    }
+    else
+    {
+        actions_valid = add_redirect(actions, STDIN_FILENO, streams.stdin_path, O_RDONLY);
+    }
+    if(out_fd != -1)
+    {
+        actions_valid = actions_valid && posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO) == 0;
+    }
+    else
+    {
+        actions_valid = actions_valid && add_redirect(actions, STDOUT_FILENO, streams.stdout_path, O_WRONLY | O_CREAT | stdout_mode);
+    }
+    actions_valid = actions_valid && add_redirect(actions, STDERR_FILENO, streams.stderr_path, O_WRONLY | O_CREAT | stderr_mode);
+    if(!actions_valid)
+    {
+        posix_spawn_file_actions_destroy(&actions);
+        terminal.print_error("Unable to redirect child stdin, stdout and stderr\r\n");
+        return false;
+    }
+    int err = posix_spawn(&p_id, path.c_str(), &actions, NULL, arguments.data(), environment.envp());
+    posix_spawn_file_actions_destroy(&actions);
+    if(err != 0)
+    {
+        // failures opening redirections are reported through the same error as exec failures
+        bool redirected = streams.stdin_path.length() > 0 || streams.stdout_path.length() > 0 || streams.stderr_path.length() > 0;
+        terminal.print_error("Unable to start '%s'%s: %s\r\n", path.c_str(), redirected ? " with its redirections" : "", std::strerror(err));
+        return false;
+    }
+    return true;
 }
 
-std::vector<std::string> parse_env_path()
+int exec_process(TerminalIO& terminal, Environment& environment, ExecutableCache& executables, JobTable& jobs, bool background, const std::vector<Value>& args, const TerminalStream& streams)
 {
-    std::vector<std::string> paths;
-    char* path = getenv("PATH");
-    if(path == NULL)
+    std::string path;
+    if(!find_program(terminal, executables, args[0].str(), path))
     {
-        return paths;
+        return -1;
     }
-    size_t index = 0;
-    std::string path_elem;
-    while(path[index] != 0)
+    jobs.reap();
+    int status = 1;
+    terminal.flush();
+    terminal.disable_raw_mode();
+    pid_t p_id;
+    if(spawn_program(terminal, environment, path, args, streams, -1, -1, p_id))
     {
-        if(path[index] == ':')
+        if(background)
         {
-            if(path_elem.length() > 0)
-            {
-                paths.emplace_back(path_elem);
-            }
-            path_elem = "";
+            jobs.add(p_id, args);
         }
         else
         {
-            path_elem += path[index];
+            waitpid(p_id, &status, 0);
         }
-        index++;
     }
-    if(path_elem.length() > 0)
-    {
-        paths.emplace_back(path_elem);
-    }
-    return paths;
+    terminal.enable_raw_mode();
+    return status;
 }
 
-static std::string get_file_path(FILE* handle)
+// reads everything the program writes to stdout into output, up to CAPTURE_LIMIT bytes
+// anything beyond the limit is drained and dropped so the child never blocks on a full pipe
+int capture_process(TerminalIO& terminal, Environment& environment, ExecutableCache& executables, JobTable& jobs, const std::vector<Value>& args, const TerminalStream& streams, std::string& output)
 {
-    int file_no = fileno(handle);
-    if(file_no == -1)
-    {
-        return NULL;
-    }
-    std::string proclink;
-    int buffer_size = std::snprintf(proclink.data(), 0, "/proc/self/fd/%d", file_no);
-    if(buffer_size < 0)
+    output.clear();
+    std::string path;
+    if(!find_program(terminal, executables, args[0].str(), path))
     {
-        return "";
+        return -1;
     }
-    proclink.reserve(buffer_size / sizeof(char));
-    buffer_size = std::snprintf(proclink.data(), buffer_size, "/proc/self/fd/%d", file_no);
-    if(buffer_size < 0)
+    int pipe_fds[2];
+    if(pipe2(pipe_fds, O_CLOEXEC) == -1)
     {
-        return "";
+        terminal.print_error("Unable to create pipe\r\n");
+        return 1;
     }
-    char* res = realpath(proclink.c_str(), NULL);
-    if(res == NULL)
+    jobs.reap();
+    int status = 1;
+    terminal.flush();
+    terminal.disable_raw_mode();
+    pid_t p_id;
+    bool started = spawn_program(terminal, environment, path, args, streams, -1, pipe_fds[1], p_id);
+    close(pipe_fds[1]);
+    if(started)
     {
-        return "";
+        std::size_t length = 0;
+        bool truncated = false;
+        output.resize(CAPTURE_INITIAL_SIZE);
+        while(true)
+        {
+            if(length == output.size() && !truncated)
+            {
+                if(output.size() >= CAPTURE_LIMIT)
+                {
+                    truncated = true;
+                }
+                else
+                {
+                    output.resize(std::min(output.size() * 2, (std::size_t)CAPTURE_LIMIT));
+                }
+            }
+            char discard[4096];
+            ssize_t num_read;
+            if(truncated)
+            {
+                num_read = read(pipe_fds[0], discard, sizeof(discard));
+            }
+            else
+            {
+                num_read = read(pipe_fds[0], output.data() + length, output.size() - length);
+            }
+            if(num_read == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if(num_read <= 0)
+            {
+                break;
+            }
+            if(!truncated)
+            {
+                length += num_read;
+            }
+        }
+        output.resize(length);
+        waitpid(p_id, &status, 0);
+        if(truncated)
+        {
+            terminal.print_error("Output of '%s' truncated to %zu bytes\r\n", args[0].c_str(), (std::size_t)CAPTURE_LIMIT);
+        }
     }
-    return res;
+    close(pipe_fds[0]);
+    terminal.enable_raw_mode();
+    return status;
 }
 
-int exec_process(TerminalIO& terminal, bool background, const std::vector<std::string>& args, const TerminalStream& streams)
+// every stage runs at once with each stdout connected straight to the next stdin through a pipe
+// stdin redirection applies to the first stage, stdout redirection to the last and stderr to all of them
+int exec_pipeline(TerminalIO& terminal, Environment& environment, ExecutableCache& executables, JobTable& jobs, bool background, const std::vector<std::vector<Value>>& commands, const TerminalStream& streams)
 {
-    std::vector<std::string> paths;
-    bool has_slash = false;
-    for(size_t i = 0; i < args[0].length() && !has_slash; i++)
+    std::vector<std::string> paths(commands.size());
+    for(std::size_t i = 0; i < commands.size(); i++)
     {
-        if(args[0][i] == '/')
+        if(!find_program(terminal, executables, commands[i][0].str(), paths[i]))
+        {
+            return -1;
+        }
+    }
+    jobs.reap();
+    terminal.flush();
+    terminal.disable_raw_mode();
+    std::vector<pid_t> p_ids;
+    int in_fd = -1;
+    bool valid = true;
+    for(std::size_t i = 0; i < commands.size() && valid; i++)
+    {
+        int pipe_fds[2] = {-1, -1};
+        if(i + 1 < commands.size() && pipe2(pipe_fds, O_CLOEXEC) == -1)
+        {
+            terminal.print_error("Unable to create pipe\r\n");
+            valid = false;
+            break;
+        }
+        pid_t p_id;
+        if(spawn_program(terminal, environment, paths[i], commands[i], streams, in_fd, pipe_fds[1], p_id))
+        {
+            p_ids.emplace_back(p_id);
+        }
+        else
+        {
+            valid = false;
+        }
+        // the children hold their own copies so the parent's ends are closed straight away
+        // this lets each stage see end of file once the stage before it exits
+        if(in_fd != -1)
+        {
+            close(in_fd);
+        }
+        if(pipe_fds[1] != -1)
         {
-            has_slash = true;
+            close(pipe_fds[1]);
         }
+        in_fd = pipe_fds[0];
     }
-    if(has_slash)
+    if(in_fd != -1)
     {
-        paths.emplace_back(args[0]);
+        close(in_fd);
+    }
+    int status = valid ? 0 : 1;
+    if(background)
+    {
+        for(std::size_t i = 0; i < p_ids.size(); i++)
+        {
+            jobs.add(p_ids[i], commands[i]);
+        }
     }
     else
     {
-        paths = parse_env_path();
-        for(size_t i = 0; i < paths.size(); i++)
+        for(std::size_t i = 0; i < p_ids.size(); i++)
         {
-            if(paths[i].back() != '/')
+            int stage_status;
+            waitpid(p_ids[i], &stage_status, 0);
+            if(valid && i + 1 == p_ids.size())
             {
-                paths[i] += '/';
+                status = stage_status;
             }
-            paths[i] += args[0];
         }
     }
-    for(size_t i = 0; i < paths.size(); i++)
+    terminal.enable_raw_mode();
+    return status;
+}
+
+// the job's own copy of streams, where redirected output goes to the redirection path followed by '.' and the job's index
+static TerminalStream job_streams(const TerminalStream& streams, std::size_t index)
+{
+    TerminalStream res = streams;
+    if(res.stdout_path.length() > 0)
+    {
+        res.stdout_path += "." + std::to_string(index);
+    }
+    if(res.stderr_path.length() > 0)
+    {
+        res.stderr_path += "." + std::to_string(index);
+    }
+    return res;
+}
+
+// children are waited on through pidfds so finishing jobs are collected as soon as any of them exits
+// Ctrl-C stops any more jobs starting, those left keep the -1 status of a job that couldn't start
+// without reaping background jobs, if a pidfd can't be opened the oldest job is waited on instead
+int exec_parallel(TerminalIO& terminal, Environment& environment, ExecutableCache& executables, JobTable& jobs, std::size_t max_jobs, const std::vector<Value>& args, const std::vector<Value>& items, const TerminalStream& streams, std::vector<int>& statuses)
+{
+    statuses.assign(items.size(), -1);
+    if(items.size() == 0)
+    {
+        return 0;
+    }
+    std::string path;
+    if(!find_program(terminal, executables, args[0].str(), path))
+    {
+        return -1;
+    }
+    jobs.reap();
+    terminal.flush();
+    terminal.disable_raw_mode();
+    std::vector<Value> job_args = args;
+    job_args.emplace_back();
+    std::vector<pid_t> p_ids;
+    std::vector<std::size_t> indices;
+    std::vector<struct pollfd> pidfds;
+    bool polling = true;
+    std::size_t next = 0;
+    int failed = 0;
+    while(next < items.size() || p_ids.size() > 0)
     {
-        if(access(paths[i].c_str(), X_OK) == 0)
+        while(p_ids.size() < max_jobs && next < items.size())
         {
-            char** arguments = get_argument_list(args);
-            int status = 1;
-            pid_t p_id = vfork();
-            if(p_id == -1)
+            // after Ctrl-C nothing more is started, the jobs in flight are still waited on
+            if(terminal.should_quit())
             {
-                terminal.print_error("Unable to create new processes\r\n");
+                failed += items.size() - next;
+                next = items.size();
+                break;
             }
-            else if(p_id == 0)
+            job_args.back() = items[next];
+            pid_t p_id;
+            if(spawn_program(terminal, environment, path, job_args, job_streams(streams, next), -1, -1, p_id))
             {
-                terminal.disable_raw_mode();
-                bool stdin_valid = true;
-                if(streams.stdin_path.length() > 0)
-                {
-                    std::string current_stdin = get_file_path(stdin);
-                    if(current_stdin.length() == 0 || streams.stdin_path != current_stdin)
-                    {
-                        FILE* stdin_res = std::freopen(streams.stdin_path.c_str(), "r", stdin);    
-                        stdin_valid = (stdin_res != NULL);
-                    }
-                }
-                bool stdout_valid = true;
-                if(streams.stdout_path.length() > 0)
-                {
-                    std::string current_stdout = get_file_path(stdout);
-                    if(streams.stdout_append)
-                    {
-                        if(current_stdout.length() == 0 || streams.stdout_path != current_stdout)
-                        {
-                            FILE* stdout_res = freopen(streams.stdout_path.c_str(), "a", stdout);
-                            stdout_valid = (stdout_res != NULL);
-                        }
-                    }
-                    else
-                    {
-                        if(current_stdout.length() == 0 || streams.stdout_path != current_stdout)
-                        {
-                            FILE* stdout_res = freopen(streams.stdout_path.c_str(), "w", stdout);    
-                            stdout_valid = (stdout_res != NULL);
-                        }
-                    }
-                }
-                bool stderr_valid = true;
-                if(streams.stderr_path.length() > 0)
-                {
-                    std::string current_stderr = get_file_path(stdout);
-                    if(streams.stderr_append)
-                    {
-                        if(current_stderr.length() == 0 || streams.stderr_path != current_stderr)
-                        {
-                            FILE* stderr_res = freopen(streams.stderr_path.c_str(), "a", stderr);
-                            stderr_valid = (stderr_res != NULL);
-                        }
-                    }
-                    else
-                    {
-                        if(current_stderr.length() == 0 || streams.stderr_path != current_stderr)
-                        {
-                            FILE* stderr_res = freopen(streams.stderr_path.c_str(), "w", stderr);    
-                            stderr_valid = (stderr_res != NULL);
-                        }
-                    }
-                    
-                }
-                if(!stdin_valid || !stdout_valid || !stderr_valid)
-                {
-                    terminal.print_error("Unable to redirect child stdin, stdout and stderr\r\n");
-                    fclose(stdin);
-                    fclose(stdout);
-                    fclose(stderr);
-                    _exit(1);
-                }
-                // child, call exec
-                int res = execve(paths[i].c_str(), arguments, __environ);
-                fclose(stdin);
-                fclose(stdout);
-                fclose(stderr);
-                _exit(res);
+                int pidfd = polling ? open_pidfd(p_id) : -1;
+                polling = pidfd != -1;
+                p_ids.emplace_back(p_id);
+                indices.emplace_back(next);
+                pidfds.emplace_back((struct pollfd){.fd = pidfd, .events = POLLIN, .revents = 0});
             }
             else
             {
-                if(!background)
-                {
-                    wait(&status);
-                }
-                terminal.enable_raw_mode();
+                failed++;
             }
-            for(size_t i = 0; i < args.size(); i++)
+            next++;
+        }
+        if(p_ids.size() == 0)
+        {
+            continue;
+        }
+        std::size_t done = 0;
+        if(polling)
+        {
+            while(poll(pidfds.data(), pidfds.size(), -1) == -1 && errno == EINTR);
+            while(done < pidfds.size() && pidfds[done].revents == 0)
             {
-                delete[] arguments[i];
+                done++;
             }
-            delete[] arguments;
-            return status;
+            if(done == pidfds.size())
+            {
+                done = 0;
+            }
+        }
+        waitpid(p_ids[done], &statuses[indices[done]], 0);
+        if(statuses[indices[done]] != 0)
+        {
+            failed++;
+        }
+        if(pidfds[done].fd != -1)
+        {
+            close(pidfds[done].fd);
         }
+        p_ids.erase(p_ids.begin() + done);
+        indices.erase(indices.begin() + done);
+        pidfds.erase(pidfds.begin() + done);
     }
-    terminal.print_error("Unknown command '%s'\r\n", args[0].c_str());
-    return -1;
+    terminal.enable_raw_mode();
+    return failed;
 }
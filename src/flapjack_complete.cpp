@@ -0,0 +1,68 @@
+#include <flapjack_complete.h>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdlib>
+
+// listings of more directories than this are dropped wholesale rather than tracked for age
+#define MAX_CACHED_DIRS 256
+
+Completer::Completer(ExecutableCache& executables) : executables(executables)
+{
+
+}
+
+void Completer::complete(const std::string& word, std::vector<std::string>& matches)
+{
+    matches.clear();
+    std::size_t slash = word.rfind('/');
+    std::string dir_part = slash == std::string::npos ? "" : word.substr(0, slash + 1);
+    std::string prefix = slash == std::string::npos ? word : word.substr(slash + 1);
+    // a bare name could be a program as well as something in the current directory
+    if(slash == std::string::npos)
+    {
+        executables.complete(prefix, matches);
+    }
+    std::string dir_path = dir_part.length() > 0 ? dir_part : ".";
+    // relative listings are cached under the absolute path so changing directory doesn't reuse them
+    std::string key = dir_path;
+    if(key[0] != '/')
+    {
+        char* cwd = getcwd(NULL, 0);
+        if(cwd != NULL)
+        {
+            key = std::string(cwd) + "/" + key;
+            free(cwd); // cwd is malloced
+        }
+    }
+    if(dirs.size() >= MAX_CACHED_DIRS && dirs.find(key) == dirs.end())
+    {
+        dirs.clear();
+    }
+    DirIndex& index = dirs.try_emplace(key, DirIndex{false, {0, 0}, {}, {}}).first->second;
+    if(update_dir_index(dir_path, index))
+    {
+        std::size_t start;
+        std::size_t end;
+        find_prefix(index, prefix, start, end);
+        for(std::size_t i = start; i < end; i++)
+        {
+            const std::string& name = index.names[i];
+            // hidden entries are only offered once a '.' has been typed
+            if(name[0] == '.' && prefix.length() == 0)
+            {
+                continue;
+            }
+            bool is_dir = index.types[i] == DT_DIR;
+            if(index.types[i] == DT_LNK || index.types[i] == DT_UNKNOWN)
+            {
+                struct stat entry_state;
+                is_dir = stat((dir_part + name).c_str(), &entry_state) == 0 && S_ISDIR(entry_state.st_mode);
+            }
+            matches.emplace_back(dir_part + name + (is_dir ? "/" : ""));
+        }
+    }
+    std::sort(matches.begin(), matches.end());
+    matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+}
@@ -0,0 +1,382 @@
+#include <flapjack_dir.h>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define DENTS_BUFFER_SIZE (1024 * 1024)
+#define STATX_BATCH 256
+// below this average cost per entry the inodes are already cached and a plain statx loop beats handing
+// the work to io_uring's worker threads, above it the lookups are hitting disk and benefit from running in parallel
+#define STATX_SLOW_NS 20000
+#define STATX_FIELDS (STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME)
+
+// minimal io_uring setup used only for batches of statx, liburing isn't a dependency of the shell
+class StatxRing
+{
+public:
+    StatxRing();
+    ~StatxRing();
+    bool usable() const;
+    bool submit(int dir_fd, const std::vector<const char*>& paths, std::vector<struct statx>& bufs, std::vector<int>& results);
+private:
+    int ring_fd;
+    void* ring;
+    std::size_t ring_size;
+    void* sqe_mem;
+    std::size_t sqe_size;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+};
+
+StatxRing::StatxRing() : ring_fd(-1), ring(MAP_FAILED), ring_size(0), sqe_mem(MAP_FAILED), sqe_size(0)
+{
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    ring_fd = syscall(SYS_io_uring_setup, STATX_BATCH, &params);
+    if(ring_fd < 0)
+    {
+        return;
+    }
+    // older kernels accept the ring but not statx as an opcode, so support is asked for once here rather than guessed from results
+    std::vector<char> probe_mem(sizeof(struct io_uring_probe) + (IORING_OP_STATX + 1) * sizeof(struct io_uring_probe_op), 0);
+    struct io_uring_probe* probe = (struct io_uring_probe*)probe_mem.data();
+    if(!(params.features & IORING_FEAT_SINGLE_MMAP)
+        || syscall(SYS_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, IORING_OP_STATX + 1) < 0
+        || probe->last_op < IORING_OP_STATX || !(probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED))
+    {
+        close(ring_fd);
+        ring_fd = -1;
+        return;
+    }
+    ring_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+    ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    sqe_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqe_mem = mmap(NULL, sqe_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if(ring == MAP_FAILED || sqe_mem == MAP_FAILED)
+    {
+        close(ring_fd);
+        ring_fd = -1;
+        return;
+    }
+    char* base = (char*)ring;
+    sq_tail = (unsigned*)(base + params.sq_off.tail);
+    sq_mask = (unsigned*)(base + params.sq_off.ring_mask);
+    sq_array = (unsigned*)(base + params.sq_off.array);
+    cq_head = (unsigned*)(base + params.cq_off.head);
+    cq_tail = (unsigned*)(base + params.cq_off.tail);
+    cq_mask = (unsigned*)(base + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(base + params.cq_off.cqes);
+    sqes = (struct io_uring_sqe*)sqe_mem;
+}
+
+StatxRing::~StatxRing()
+{
+    if(ring != MAP_FAILED)
+    {
+        munmap(ring, ring_size);
+    }
+    if(sqe_mem != MAP_FAILED)
+    {
+        munmap(sqe_mem, sqe_size);
+    }
+    if(ring_fd >= 0)
+    {
+        close(ring_fd);
+    }
+}
+
+bool StatxRing::usable() const
+{
+    return ring_fd >= 0;
+}
+
+// paths.size() must not exceed STATX_BATCH, results holds the statx return value for each path
+bool StatxRing::submit(int dir_fd, const std::vector<const char*>& paths, std::vector<struct statx>& bufs, std::vector<int>& results)
+{
+    unsigned tail = *sq_tail;
+    for(std::size_t i = 0; i < paths.size(); i++)
+    {
+        unsigned index = (tail + i) & *sq_mask;
+        struct io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = dir_fd;
+        sqe->addr = (std::uint64_t)paths[i];
+        sqe->len = STATX_FIELDS;
+        sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+        sqe->off = (std::uint64_t)&bufs[i];
+        sqe->user_data = i;
+        sq_array[index] = index;
+    }
+    __atomic_store_n(sq_tail, tail + (unsigned)paths.size(), __ATOMIC_RELEASE);
+    std::size_t completed = 0;
+    std::size_t expected = paths.size();
+    unsigned to_submit = paths.size();
+    bool failed = false;
+    while(completed < expected)
+    {
+        int ret = syscall(SYS_io_uring_enter, ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(ret < 0 && errno != EINTR && !failed)
+        {
+            if(to_submit == paths.size())
+            {
+                return false;
+            }
+            // statx already handed to the kernel still write into bufs, so they are all waited on
+            // before the caller is allowed to give up on the ring and free the buffers
+            failed = true;
+            expected = paths.size() - to_submit;
+            to_submit = 0;
+        }
+        if(ret > 0)
+        {
+            to_submit -= std::min<unsigned>(to_submit, ret);
+        }
+        unsigned head = *cq_head;
+        unsigned cq_end = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        while(head != cq_end)
+        {
+            struct io_uring_cqe* cqe = &cqes[head & *cq_mask];
+            results[cqe->user_data] = cqe->res;
+            head++;
+            completed++;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+    return !failed;
+}
+
+static DirEntryInfo make_info(const struct statx& buf)
+{
+    DirEntryInfo info;
+    info.valid = true;
+    info.mode = buf.stx_mode;
+    info.size = buf.stx_size;
+    info.mtime = buf.stx_mtime.tv_sec;
+    return info;
+}
+
+DirListing::DirListing() : dir_fd(-1)
+{
+
+}
+
+DirListing::~DirListing()
+{
+    if(dir_fd >= 0)
+    {
+        close(dir_fd);
+    }
+}
+
+bool DirListing::read(const std::string& path)
+{
+    return read_entries(open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+}
+
+bool DirListing::read_at(int parent_fd, const std::string& path)
+{
+    return read_entries(openat(parent_fd, path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+}
+
+// takes ownership of fd, anything read before is dropped
+bool DirListing::read_entries(int fd)
+{
+    if(dir_fd >= 0)
+    {
+        close(dir_fd);
+    }
+    dir_fd = fd;
+    names.clear();
+    entries.clear();
+    infos.clear();
+    if(dir_fd < 0)
+    {
+        return false;
+    }
+    if(dents.size() == 0)
+    {
+        dents.resize(DENTS_BUFFER_SIZE);
+    }
+    while(true)
+    {
+        ssize_t length = getdents64(dir_fd, dents.data(), dents.size());
+        if(length < 0)
+        {
+            return false;
+        }
+        if(length == 0)
+        {
+            break;
+        }
+        ssize_t offset = 0;
+        while(offset < length)
+        {
+            struct dirent64* dent = (struct dirent64*)(dents.data() + offset);
+            offset += dent->d_reclen;
+            if(std::strcmp(dent->d_name, ".") == 0 || std::strcmp(dent->d_name, "..") == 0)
+            {
+                continue;
+            }
+            std::size_t name_length = std::strlen(dent->d_name);
+            entries.push_back({names.size(), dent->d_type});
+            names.insert(names.end(), dent->d_name, dent->d_name + name_length + 1);
+        }
+    }
+    return true;
+}
+
+void DirListing::sort()
+{
+    const char* base = names.data();
+    std::sort(entries.begin(), entries.end(), [base](const DirEntry& a, const DirEntry& b)
+    {
+        return std::strcmp(base + a.name_offset, base + b.name_offset) < 0;
+    });
+}
+
+void DirListing::stat_sync(std::size_t start, std::size_t end)
+{
+    for(std::size_t i = start; i < end; i++)
+    {
+        struct statx buf;
+        if(statx(dir_fd, name(i), AT_SYMLINK_NOFOLLOW, STATX_FIELDS, &buf) == 0)
+        {
+            infos[i] = make_info(buf);
+        }
+    }
+}
+
+void DirListing::stat_entries()
+{
+    infos.assign(entries.size(), DirEntryInfo{false, 0, 0, 0});
+    // the first batch is always done directly and timed to decide whether the ring is worth setting up
+    std::size_t first_end = std::min(entries.size(), (std::size_t)STATX_BATCH);
+    struct timespec start_time;
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    stat_sync(0, first_end);
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    if(first_end == entries.size())
+    {
+        return;
+    }
+    long elapsed = (end_time.tv_sec - start_time.tv_sec) * 1000000000L + (end_time.tv_nsec - start_time.tv_nsec);
+    if(elapsed / (long)first_end < STATX_SLOW_NS)
+    {
+        stat_sync(first_end, entries.size());
+        return;
+    }
+    std::vector<const char*> paths;
+    std::vector<struct statx> bufs(STATX_BATCH);
+    std::vector<int> results(STATX_BATCH);
+    // declared after the buffers so the ring is closed before the memory it writes into is freed
+    StatxRing ring;
+    for(std::size_t start = first_end; start < entries.size(); start += STATX_BATCH)
+    {
+        std::size_t end = std::min(entries.size(), start + STATX_BATCH);
+        paths.clear();
+        for(std::size_t i = start; i < end; i++)
+        {
+            paths.push_back(name(i));
+        }
+        if(!ring.usable() || !ring.submit(dir_fd, paths, bufs, results))
+        {
+            // fall back for this and every later batch
+            stat_sync(start, entries.size());
+            return;
+        }
+        for(std::size_t i = start; i < end; i++)
+        {
+            if(results[i - start] == 0)
+            {
+                infos[i] = make_info(bufs[i - start]);
+            }
+        }
+    }
+}
+
+bool update_dir_index(const std::string& path, DirIndex& index)
+{
+    struct stat dir_state;
+    if(stat(path.c_str(), &dir_state) == -1)
+    {
+        index.loaded = false;
+        index.names.clear();
+        index.types.clear();
+        return false;
+    }
+    if(index.loaded && dir_state.st_mtim.tv_sec == index.mtime.tv_sec && dir_state.st_mtim.tv_nsec == index.mtime.tv_nsec)
+    {
+        return true;
+    }
+    DirListing listing;
+    index.loaded = listing.read(path);
+    index.mtime = dir_state.st_mtim;
+    index.names.clear();
+    index.types.clear();
+    if(!index.loaded)
+    {
+        return false;
+    }
+    listing.sort();
+    index.names.reserve(listing.size());
+    index.types.reserve(listing.size());
+    for(std::size_t i = 0; i < listing.size(); i++)
+    {
+        index.names.emplace_back(listing.name(i));
+        index.types.emplace_back(listing.type(i));
+    }
+    return true;
+}
+
+void find_prefix(const DirIndex& index, const std::string& prefix, std::size_t& start, std::size_t& end)
+{
+    auto first = std::lower_bound(index.names.begin(), index.names.end(), prefix);
+    auto last = first;
+    while(last != index.names.end() && last->compare(0, prefix.length(), prefix) == 0)
+    {
+        last++;
+    }
+    start = first - index.names.begin();
+    end = last - index.names.begin();
+}
+
+std::size_t DirListing::size() const
+{
+    return entries.size();
+}
+
+const char* DirListing::name(std::size_t index) const
+{
+    return names.data() + entries[index].name_offset;
+}
+
+unsigned char DirListing::type(std::size_t index) const
+{
+    return entries[index].type;
+}
+
+const DirEntryInfo& DirListing::info(std::size_t index) const
+{
+    return infos[index];
+}
+
+int DirListing::fd() const
+{
+    return dir_fd;
+}
@@ -0,0 +1,75 @@
+#include <flapjack_env.h>
+#include <cstring>
+
+Environment::Environment(char** initial) : snapshot_valid(false), changes(0)
+{
+    for(std::size_t i = 0; initial != NULL && initial[i] != NULL; i++)
+    {
+        const char* equals = std::strchr(initial[i], '=');
+        if(equals != NULL && equals != initial[i])
+        {
+            variables.emplace(std::string(initial[i], equals - initial[i]), equals + 1);
+        }
+    }
+}
+
+bool Environment::set(const std::string& name, const std::string& value)
+{
+    if(name.length() == 0 || name.find('=') != std::string::npos || name.find('\0') != std::string::npos)
+    {
+        return false;
+    }
+    auto [variable, inserted] = variables.try_emplace(name, value);
+    if(!inserted)
+    {
+        if(variable->second == value)
+        {
+            return true;
+        }
+        variable->second = value;
+    }
+    snapshot_valid = false;
+    changes++;
+    return true;
+}
+
+const std::string* Environment::get(const std::string& name) const
+{
+    auto variable = variables.find(name);
+    if(variable == variables.end())
+    {
+        return NULL;
+    }
+    return &variable->second;
+}
+
+char* const* Environment::envp()
+{
+    if(!snapshot_valid)
+    {
+        snapshot.clear();
+        snapshot.reserve(variables.size());
+        for(const auto& [name, value] : variables)
+        {
+            snapshot.emplace_back(name + "=" + value);
+        }
+        snapshot_envp.clear();
+        for(std::string& entry : snapshot)
+        {
+            snapshot_envp.emplace_back(entry.data());
+        }
+        snapshot_envp.emplace_back(nullptr);
+        snapshot_valid = true;
+    }
+    return snapshot_envp.data();
+}
+
+const std::unordered_map<std::string, std::string>& Environment::entries() const
+{
+    return variables;
+}
+
+std::size_t Environment::version() const
+{
+    return changes;
+}
@@ -0,0 +1,174 @@
+#include <flapjack_history.h>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// queries shorter than a trigram are matched by scanning back through the entries
+#define TRIGRAM_LENGTH 3
+
+static std::uint32_t make_trigram(const char* text)
+{
+    return ((std::uint32_t)(unsigned char)text[0] << 16) | ((std::uint32_t)(unsigned char)text[1] << 8) | (unsigned char)text[2];
+}
+
+History::History() : file(-1), mapping(MAP_FAILED), mapping_length(0), loaded(0), index_ready(false), stop_indexing(false)
+{
+
+}
+
+History::~History()
+{
+    stop_indexing = true;
+    if(indexer.joinable())
+    {
+        indexer.join();
+    }
+    if(mapping != MAP_FAILED)
+    {
+        munmap(mapping, mapping_length);
+    }
+    if(file != -1)
+    {
+        close(file);
+    }
+}
+
+// a history that can't be opened is used for this session only
+void History::load(const std::string& path)
+{
+    file = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if(file == -1)
+    {
+        return;
+    }
+    struct stat file_state;
+    if(fstat(file, &file_state) == -1 || file_state.st_size == 0)
+    {
+        return;
+    }
+    mapping_length = file_state.st_size;
+    mapping = mmap(NULL, mapping_length, PROT_READ, MAP_PRIVATE, file, 0);
+    if(mapping == MAP_FAILED)
+    {
+        return;
+    }
+    const char* start = static_cast<const char*>(mapping);
+    const char* end = start + mapping_length;
+    while(start < end)
+    {
+        const char* newline = static_cast<const char*>(std::memchr(start, '\n', end - start));
+        if(newline == NULL)
+        {
+            newline = end;
+        }
+        if(newline > start)
+        {
+            entries.emplace_back(start, newline - start);
+        }
+        start = newline + 1;
+    }
+    loaded = entries.size();
+    // the indexer gets its own copy of the views as entries may reallocate when lines are added
+    indexer = std::thread(&History::build_index, this, entries);
+}
+
+void History::add(const std::string& line)
+{
+    if(line.length() == 0 || line.find('\n') != std::string::npos)
+    {
+        return;
+    }
+    added.emplace_back(line);
+    entries.emplace_back(added.back());
+    if(file != -1)
+    {
+        std::string record = line + "\n";
+        // a single write to an O_APPEND file so shells sharing the history don't interleave their lines
+        if(write(file, record.data(), record.length()) != (ssize_t)record.length())
+        {
+            close(file);
+            file = -1;
+        }
+    }
+}
+
+std::size_t History::size() const
+{
+    return entries.size();
+}
+
+std::string_view History::entry(std::size_t index) const
+{
+    return entries[index];
+}
+
+// indexing a million entries takes around a second so it happens off the prompt's thread
+void History::build_index(std::vector<std::string_view> loaded_entries)
+{
+    for(std::size_t index = 0; index < loaded_entries.size(); index++)
+    {
+        if(stop_indexing)
+        {
+            return;
+        }
+        std::string_view text = loaded_entries[index];
+        for(std::size_t i = 0; i + TRIGRAM_LENGTH <= text.length(); i++)
+        {
+            std::vector<std::uint32_t>& postings = trigrams[make_trigram(text.data() + i)];
+            if(postings.size() == 0 || postings.back() != index)
+            {
+                postings.emplace_back(index);
+            }
+        }
+    }
+    index_ready.store(true, std::memory_order_release);
+}
+
+bool History::search(std::string_view query, std::size_t before, std::size_t& found)
+{
+    before = std::min(before, entries.size());
+    // entries added this session are scanned directly, as is everything while the index is being built
+    // or the query is shorter than a trigram
+    bool use_index = query.length() >= TRIGRAM_LENGTH && index_ready.load(std::memory_order_acquire);
+    std::size_t scan_end = use_index ? std::min(before, loaded) : 0;
+    for(std::size_t i = before; i > scan_end; i--)
+    {
+        if(entries[i - 1].find(query) != std::string_view::npos)
+        {
+            found = i - 1;
+            return true;
+        }
+    }
+    if(!use_index)
+    {
+        return false;
+    }
+    // every match contains all of the query's trigrams so only the rarest one's entries need checking
+    const std::vector<std::uint32_t>* rarest = NULL;
+    for(std::size_t i = 0; i + TRIGRAM_LENGTH <= query.length(); i++)
+    {
+        auto postings = trigrams.find(make_trigram(query.data() + i));
+        if(postings == trigrams.end())
+        {
+            return false;
+        }
+        if(rarest == NULL || postings->second.size() < rarest->size())
+        {
+            rarest = &postings->second;
+        }
+    }
+    auto candidate = std::lower_bound(rarest->begin(), rarest->end(), before);
+    while(candidate != rarest->begin())
+    {
+        candidate--;
+        if(entries[*candidate].find(query) != std::string_view::npos)
+        {
+            found = *candidate;
+            return true;
+        }
+    }
+    return false;
+}
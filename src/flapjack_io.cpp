@@ -3,8 +3,15 @@
 #include <vector>
 #include <cstdio>
 #include <cstdarg>
+#include <cstring>
+#include <algorithm>
 #include <unistd.h>
 #include <cctype>
+#include <cerrno>
+#include <climits>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 enum KeyValue: char
 {
@@ -17,6 +24,7 @@ enum KeyValue: char
     KEY_DELETE = 6,
     KEY_NEWLINE = 7,
     KEY_TAB = 8,
+    KEY_SEARCH = 9,
 };
 
 struct Key
@@ -25,68 +33,248 @@ struct Key
     char value;
 };
 
-TerminalIO::TerminalIO()
+// at most this many candidates are listed when Tab can't narrow a completion
+#define MAX_LISTED_COMPLETIONS 100
+// output is only written out once this much has built up, or at an explicit flush
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+// keys are read in chunks of up to this size so a paste costs a handful of reads rather than one per byte
+#define INPUT_BUFFER_SIZE 4096
+
+static const char* colour_codes[] = {
+    "\x1b[30m", "\x1b[31m", "\x1b[32m", "\x1b[33m",
+    "\x1b[34m", "\x1b[35m", "\x1b[36m", "\x1b[37m",
+    "\x1b[30;1m", "\x1b[31;1m", "\x1b[32;1m", "\x1b[33;1m",
+    "\x1b[34;1m", "\x1b[35;1m", "\x1b[36;1m", "\x1b[37;1m",
+};
+
+std::atomic<bool> TerminalIO::interrupted(false);
+
+void TerminalIO::handle_interrupt(int)
+{
+    interrupted.store(true, std::memory_order_relaxed);
+}
+
+// without a terminal on both stdin and stdout we run headless
+// the terminal is never touched and output is written with plain line endings and no colour
+TerminalIO::TerminalIO() : interactive(isatty(STDIN_FILENO) && isatty(STDOUT_FILENO)), input(INPUT_BUFFER_SIZE), input_pos(0), input_length(0)
 {
-    if(tcgetattr(STDIN_FILENO, &original_state) == -1)
+    if(interactive && tcgetattr(STDIN_FILENO, &original_state) == -1)
     {
         fprintf(stderr, "Unable to get terminal attributes\r\n");
         exit(1);
     }
+    struct sigaction action = {};
+    action.sa_handler = handle_interrupt;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    if(sigaction(SIGINT, &action, NULL) == -1)
+    {
+        fprintf(stderr, "Unable to install interrupt handler\r\n");
+        exit(1);
+    }
+    // when stdout and stderr are the same file errors are buffered as stdout so both keep their order in one write
+    struct stat out_state;
+    struct stat err_state;
+    error_fd = STDERR_FILENO;
+    if(fstat(STDOUT_FILENO, &out_state) == 0 && fstat(STDERR_FILENO, &err_state) == 0
+        && out_state.st_dev == err_state.st_dev && out_state.st_ino == err_state.st_ino)
+    {
+        error_fd = STDOUT_FILENO;
+    }
+    output.reserve(OUTPUT_BUFFER_SIZE);
     enable_raw_mode();
 }
 
 TerminalIO::~TerminalIO()
 {
+   flush();
    disable_raw_mode(); 
 }
 
-void TerminalIO::set_text_colour(std::FILE* stream, TerminalColour colour)
+bool TerminalIO::is_interactive() const
 {
-    std::fputs("\x1b[", stream);
-    int colour_val = static_cast<int>(colour);
-    if(colour_val >= 8)
+    return interactive;
+}
+
+void TerminalIO::write_output(int fd, const char* data, std::size_t length)
+{
+    if(output.size() + length > OUTPUT_BUFFER_SIZE)
+    {
+        flush();
+    }
+    output.insert(output.end(), data, data + length);
+    if(fd == STDERR_FILENO)
+    {
+        fd = error_fd;
+    }
+    if(segments.size() > 0 && segments.back().fd == fd)
     {
-        // 30 - 8 = 22
-        std::fprintf(stream, "%d;1m", colour_val + 22);
+        segments.back().length += length;
     }
     else
     {
-        std::fprintf(stream, "%dm", colour_val + 30);
+        segments.emplace_back((OutputSegment){.fd = fd, .length = length});
     }
-    std::fflush(stdout);
+}
+
+// when headless the shell's own "\r\n" line endings in format become plain "\n"
+// values substituted into the format are written exactly as they are
+void TerminalIO::format_output(int fd, const char* format, std::va_list args)
+{
+    char small_format[256];
+    std::vector<char> large_format;
+    if(!interactive && std::strchr(format, '\r') != NULL)
+    {
+        std::size_t format_length = std::strlen(format);
+        char* plain_format = small_format;
+        if(format_length >= sizeof(small_format))
+        {
+            large_format.resize(format_length + 1);
+            plain_format = large_format.data();
+        }
+        std::size_t length = 0;
+        for(const char* c = format; *c != '\0'; c++)
+        {
+            if(*c != '\r' || c[1] != '\n')
+            {
+                plain_format[length++] = *c;
+            }
+        }
+        plain_format[length] = '\0';
+        format = plain_format;
+    }
+    char small[256];
+    std::va_list retry;
+    va_copy(retry, args);
+    int length = std::vsnprintf(small, sizeof(small), format, args);
+    if(length < 0)
+    {
+        va_end(retry);
+        return;
+    }
+    if(static_cast<std::size_t>(length) < sizeof(small))
+    {
+        write_output(fd, small, length);
+    }
+    else
+    {
+        std::vector<char> large(length + 1);
+        std::vsnprintf(large.data(), large.size(), format, retry);
+        write_output(fd, large.data(), length);
+    }
+    va_end(retry);
+}
+
+// carries on after partial writes and interrupted calls until every buffer has been written
+static void write_vector(int fd, std::vector<struct iovec>& iov)
+{
+    std::size_t first = 0;
+    while(first < iov.size())
+    {
+        int count = std::min<std::size_t>(iov.size() - first, IOV_MAX);
+        ssize_t res = writev(fd, iov.data() + first, count);
+        if(res == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        std::size_t written = res;
+        while(first < iov.size() && written >= iov[first].iov_len)
+        {
+            written -= iov[first].iov_len;
+            first++;
+        }
+        if(written > 0)
+        {
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + written;
+            iov[first].iov_len -= written;
+        }
+    }
+}
+
+// every segment for a descriptor goes out in a single writev, so a flush costs one call per descriptor
+void TerminalIO::flush()
+{
+    std::vector<struct iovec> iov;
+    iov.reserve(segments.size());
+    std::vector<int> fds;
+    for(const OutputSegment& segment : segments)
+    {
+        if(std::find(fds.begin(), fds.end(), segment.fd) == fds.end())
+        {
+            fds.push_back(segment.fd);
+        }
+    }
+    for(int fd : fds)
+    {
+        iov.clear();
+        std::size_t offset = 0;
+        for(const OutputSegment& segment : segments)
+        {
+            if(segment.fd == fd)
+            {
+                iov.push_back({output.data() + offset, segment.length});
+            }
+            offset += segment.length;
+        }
+        write_vector(fd, iov);
+    }
+    output.clear();
+    segments.clear();
+}
+
+void TerminalIO::set_text_colour(std::FILE* stream, TerminalColour colour)
+{
+    if(!interactive)
+    {
+        return;
+    }
+    const char* code = colour_codes[static_cast<int>(colour)];
+    write_output(fileno(stream), code, std::strlen(code));
 }
 
 void TerminalIO::reset_text_colour(std::FILE* stream)
 {
-    std::fputs("\x1b[0m", stream);
+    if(!interactive)
+    {
+        return;
+    }
+    write_output(fileno(stream), "\x1b[0m", 4);
 }
 
 void TerminalIO::print(const char* format, ...)
 {
     std::va_list args;
     va_start(args, format);
-    std::vfprintf(stdout, format, args);
+    format_output(STDOUT_FILENO, format, args);
     va_end(args);
-    std::fflush(stdout);
 }
 
+// errors are buffered like any other output, the paths which exit flush before leaving
 void TerminalIO::print_error(const char* format, ...)
 {
     set_text_colour(stderr, TerminalColour::LIGHT_RED);
     std::va_list args;
     va_start(args, format);
-    std::vfprintf(stderr, format, args);
+    format_output(STDERR_FILENO, format, args);
     va_end(args);
     reset_text_colour(stderr);
-    std::fflush(stderr);
 }
 
 void TerminalIO::disable_raw_mode()
 {
+    if(!interactive)
+    {
+        return;
+    }
     if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &original_state) == -1)
     {
+        flush();
         std::fprintf(stderr, "Unable to leave raw mode\r\n");
-        exit(1); 
+        exit(1);
     }
 }
 
@@ -94,8 +282,16 @@ void TerminalIO::disable_raw_mode()
 // and handling user input in raw mode
 void TerminalIO::enable_raw_mode()
 {
+    if(!interactive)
+    {
+        return;
+    }
     struct termios raw = original_state;
-    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    // ISIG stays on so Ctrl-C arrives as SIGINT, with suspend and quit keys disabled
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN);
+    raw.c_lflag |= ISIG;
+    raw.c_cc[VSUSP] = _POSIX_VDISABLE;
+    raw.c_cc[VQUIT] = _POSIX_VDISABLE;
     raw.c_iflag &= ~(BRKINT | ICRNL | IXON | INPCK | ISTRIP);
     raw.c_oflag &= ~(OPOST);
     raw.c_cflag |= (CS8);
@@ -103,53 +299,63 @@ void TerminalIO::enable_raw_mode()
     raw.c_cc[VTIME] = 1;
     if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
     {
+        flush();
         std::fprintf(stderr, "Unable to enter raw mode\r\n");
         exit(1);
     }
 }
 
-#define CNTRL_KEY(k) ((k) & 0x1f)
+void TerminalIO::clear_quit()
+{
+    interrupted.store(false, std::memory_order_relaxed);
+}
 
-bool TerminalIO::should_quit()
+// with VMIN 0 and VTIME 1 a read gives back whatever has arrived or nothing after a tenth of a second
+// wait keeps reading until a byte arrives, otherwise a timeout returns false
+bool TerminalIO::read_byte(char& c, bool wait)
 {
-    char c = 0;
-    int num_read = read(STDIN_FILENO, &c, 1);
-    if(num_read == -1 && errno != EAGAIN)
-    {
-        std::fprintf(stderr, "Unable to read key input");
-        exit(1);
-    }
-    if(num_read == 1)
+    while(input_pos == input_length)
     {
-        if(std::iscntrl(c) && c == CNTRL_KEY('c'))
+        ssize_t num_read = read(STDIN_FILENO, input.data(), input.size());
+        if(num_read > 0)
+        {
+            input_pos = 0;
+            input_length = num_read;
+            break;
+        }
+        if(num_read == -1 && errno != EAGAIN && errno != EINTR)
         {
-            return true;
+            flush();
+            std::fprintf(stderr, "Unable to read key input");
+            exit(1);
+        }
+        if(!wait)
+        {
+            return false;
         }
     }
-    return false;
+    c = input[input_pos];
+    input_pos++;
+    return true;
+}
+
+bool TerminalIO::input_pending() const
+{
+    return input_pos < input_length;
 }
 
 Key TerminalIO::read_key()
 {
-    int num_read;
     char c = 0;
-    while((num_read = read(STDIN_FILENO, &c, 1)) != 1)
-    {
-        if(num_read == -1 && errno != EAGAIN)
-        {
-            std::fprintf(stderr, "Unable to read key input");
-            exit(1);
-        }
-        c = 0;
-    }
+    read_byte(c, true);
     if(c == '\x1b')
     {
         char seq[3];
-        if(read(STDIN_FILENO, &seq[0], 1) != 1)
+        if(!read_byte(seq[0], false))
         {
             return (Key){.special = true, .value = KeyValue::KEY_INVALID};
         }
-        if(read(STDIN_FILENO, &seq[1], 1) != 1)
+        if(!read_byte(seq[1], false))
         {
             return (Key){.special = true, .value = KeyValue::KEY_INVALID};
         }
@@ -157,7 +363,7 @@ Key TerminalIO::read_key()
         {
             if(seq[1] >= '0' && seq[1] <= '9')
             {
-                if(read(STDIN_FILENO, &seq[2], 1) != 1)
+                if(!read_byte(seq[2], false))
                 {
                     return (Key){.special = true, .value = KeyValue::KEY_INVALID};
                 }
@@ -213,6 +419,11 @@ Key TerminalIO::read_key()
     {
         return (Key){.special = true, .value = KEY_TAB};
     }
+    else if(c == 18)
+    {
+        // Ctrl-R
+        return (Key){.special = true, .value = KEY_SEARCH};
+    }
     else if(!std::iscntrl(c))
     {
         return (Key){.special = false, .value = c};
@@ -220,15 +431,203 @@ Key TerminalIO::read_key()
     return (Key){.special = true, .value = KeyValue::KEY_INVALID};
 }
 
-std::string TerminalIO::get_line(const std::string& prompt, std::vector<std::string>& lines)
+// brings the screen from drawn to line by rewriting only what follows their common prefix
+// https://cloudaffle.com/series/customizing-the-prompt/moving-the-cursor/ for ansi codes for moving the cursor
+void TerminalIO::redraw_line(const std::string& line, std::size_t cursor_pos, std::string& drawn, std::size_t& drawn_cursor)
+{
+    std::size_t common = 0;
+    while(common < line.length() && common < drawn.length() && line[common] == drawn[common])
+    {
+        common++;
+    }
+    std::size_t column = drawn_cursor;
+    if(common < drawn.length() || common < line.length())
+    {
+        if(column > common)
+        {
+            print("\e[%zuD", column - common);
+        }
+        else if(column < common)
+        {
+            print("\e[%zuC", common - column);
+        }
+        write_output(STDOUT_FILENO, line.data() + common, line.length() - common);
+        if(line.length() < drawn.length())
+        {
+            print("\e[K");
+        }
+        column = line.length();
+    }
+    if(column > cursor_pos)
+    {
+        print("\e[%zuD", column - cursor_pos);
+    }
+    else if(column < cursor_pos)
+    {
+        print("\e[%zuC", cursor_pos - column);
+    }
+    drawn = line;
+    drawn_cursor = cursor_pos;
+}
+
+// Ctrl-R search, typing narrows the query and Ctrl-R again steps to an older match
+// enter runs the match and any other special key leaves it on the line for editing
+bool TerminalIO::reverse_search(History& history, std::string& line, std::size_t& row)
+{
+    std::string query = "";
+    std::size_t match = history.size();
+    bool found = false;
+    while(true)
+    {
+        if(!input_pending())
+        {
+            std::string_view shown = found ? history.entry(match) : std::string_view();
+            print("\33[2K\r(search)'%s': %.*s", query.c_str(), (int)shown.length(), shown.data());
+            flush();
+        }
+        Key next_key = read_key();
+        if(!next_key.special)
+        {
+            query += next_key.value;
+            // the current match is kept if it still contains the longer query
+            found = history.search(query, found ? match + 1 : history.size(), match);
+            continue;
+        }
+        switch(next_key.value)
+        {
+            case KeyValue::KEY_SEARCH:
+            {
+                std::size_t older;
+                if(found && history.search(query, match, older))
+                {
+                    match = older;
+                }
+                break;
+            }
+            case KeyValue::KEY_BACKSPACE:
+            {
+                if(query.length() > 0)
+                {
+                    query.pop_back();
+                }
+                found = query.length() > 0 && history.search(query, history.size(), match);
+                break;
+            }
+            default:
+            {
+                if(found)
+                {
+                    line = history.entry(match);
+                    row = match;
+                }
+                return next_key.value == KeyValue::KEY_NEWLINE;
+            }
+        }
+    }
+}
+
+// completes the word being typed into a quoted ':' literal, or a bare word which isn't a register
+// a single match is filled in along with the closing quote, several are filled in as far as they agree
+// and listed below the prompt when they don't agree on anything more, in which case true is returned
+bool TerminalIO::complete_word(Completer& completer, std::string& line, std::size_t& cursor_pos)
+{
+    char quote = 0;
+    bool escape = false;
+    std::size_t word_start = 0;
+    for(std::size_t i = 0; i < cursor_pos; i++)
+    {
+        if(escape)
+        {
+            escape = false;
+        }
+        else if(quote != 0)
+        {
+            if(line[i] == '\\')
+            {
+                escape = true;
+            }
+            else if(line[i] == quote)
+            {
+                quote = 0;
+                word_start = i + 1;
+            }
+        }
+        else if(line[i] == '"' || line[i] == '\'')
+        {
+            quote = line[i];
+            word_start = i + 1;
+        }
+        else if(line[i] == ' ')
+        {
+            word_start = i + 1;
+        }
+    }
+    std::string word = line.substr(word_start, cursor_pos - word_start);
+    if(quote == 0 && (word.length() == 0 || word.find_first_not_of("0123456789") == std::string::npos))
+    {
+        return false;
+    }
+    std::vector<std::string> matches;
+    completer.complete(word, matches);
+    if(matches.size() == 0)
+    {
+        return false;
+    }
+    std::string completed = matches[0];
+    if(matches.size() == 1)
+    {
+        if(quote != 0 && completed.back() != '/')
+        {
+            completed += quote;
+        }
+    }
+    else
+    {
+        for(const std::string& match : matches)
+        {
+            std::size_t common = 0;
+            while(common < completed.length() && common < match.length() && completed[common] == match[common])
+            {
+                common++;
+            }
+            completed.resize(common);
+        }
+    }
+    if(completed.length() > word.length())
+    {
+        line.insert(cursor_pos, completed, word.length());
+        cursor_pos += completed.length() - word.length();
+        return false;
+    }
+    print("\r\n");
+    for(std::size_t i = 0; i < matches.size() && i < MAX_LISTED_COMPLETIONS; i++)
+    {
+        print("%s  ", matches[i].c_str());
+    }
+    if(matches.size() > MAX_LISTED_COMPLETIONS)
+    {
+        print("... and %zu more", matches.size() - MAX_LISTED_COMPLETIONS);
+    }
+    print("\r\n");
+    return true;
+}
+
+std::string TerminalIO::get_line(const std::string& prompt, History& history, Completer& completer)
 {
     std::string current_line = "";
     std::size_t cursor_pos = 0;
-    std::size_t row = lines.size();
+    std::size_t row = history.size();
+    // what is currently shown after the prompt and where the cursor sits in it
+    std::string drawn_line = "";
+    std::size_t drawn_cursor = 0;
     print("\33[2K\r");
     print("%s >> ", prompt.c_str());
     while(true)
     {
+        if(!input_pending())
+        {
+            flush();
+        }
         Key next_key = read_key();
         if(next_key.special)
         {
@@ -240,7 +639,7 @@ std::string TerminalIO::get_line(const std::string& prompt, std::vector<std::str
                     {
                         current_line.erase(cursor_pos, 1);
                     }
-                    row = lines.size();
+                    row = history.size();
                     break;
                 }
                 case KeyValue::KEY_BACKSPACE:
@@ -250,7 +649,7 @@ std::string TerminalIO::get_line(const std::string& prompt, std::vector<std::str
                         current_line = current_line.erase(cursor_pos - 1, 1);
                         cursor_pos--;
                     }
-                    row = lines.size();
+                    row = history.size();
                     break;
                 }
                 case KeyValue::KEY_LEFT:
@@ -271,27 +670,58 @@ std::string TerminalIO::get_line(const std::string& prompt, std::vector<std::str
                 }
                 case KeyValue::KEY_UP:
                 {
-                    if(row > 0 && lines.size() > 0)
+                    if(row > 0 && history.size() > 0)
                     {
                         row--;
-                        current_line = lines[row];
+                        current_line = history.entry(row);
                         cursor_pos = current_line.length();
                     }
                     break;
                 }
                 case KeyValue::KEY_DOWN:
                 {
-                    if(lines.size() != 0 && row < lines.size() - 1)
+                    if(history.size() != 0 && row < history.size() - 1)
                     {
                         row++;
-                        current_line = lines[row];
+                        current_line = history.entry(row);
                         cursor_pos = current_line.length();
                     }
                     break;
                 }
+                case KeyValue::KEY_SEARCH:
+                {
+                    bool run = reverse_search(history, current_line, row);
+                    cursor_pos = current_line.length();
+                    // the search replaced the prompt so it is drawn again from scratch
+                    print("\33[2K\r%s >> ", prompt.c_str());
+                    drawn_line = "";
+                    drawn_cursor = 0;
+                    if(run)
+                    {
+                        redraw_line(current_line, cursor_pos, drawn_line, drawn_cursor);
+                        print("\r\n");
+                        flush();
+                        return current_line;
+                    }
+                    break;
+                }
+                case KeyValue::KEY_TAB:
+                {
+                    if(complete_word(completer, current_line, cursor_pos))
+                    {
+                        // the candidates were listed under the old prompt so it is drawn again below them
+                        print("\33[2K\r%s >> ", prompt.c_str());
+                        drawn_line = "";
+                        drawn_cursor = 0;
+                    }
+                    row = history.size();
+                    break;
+                }
                 case KeyValue::KEY_NEWLINE:
                 {
+                    redraw_line(current_line, current_line.length(), drawn_line, drawn_cursor);
                     print("\r\n");
+                    flush();
                     return current_line;
                 }
                 default:
@@ -303,13 +733,13 @@ std::string TerminalIO::get_line(const std::string& prompt, std::vector<std::str
         else
         {
            current_line.insert(cursor_pos, 1, next_key.value);
-           row = lines.size();
+           row = history.size();
            cursor_pos++;
         }
-        print("\33[2K\r");
-        print("%s >> %s", prompt.c_str(), current_line.c_str());
-        // https://cloudaffle.com/series/customizing-the-prompt/moving-the-cursor/ for ansi codes for moving the cursor
-        print("\e[1C");
-        print("\e[%zuD", current_line.length() - cursor_pos + 1);
+        // keys which already arrived, as in a paste, are all applied before the screen is touched
+        if(!input_pending())
+        {
+            redraw_line(current_line, cursor_pos, drawn_line, drawn_cursor);
+        }
     }
 }
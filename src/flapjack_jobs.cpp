@@ -0,0 +1,148 @@
+#include <flapjack_jobs.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+
+// finished jobs are kept for '&' to report, beyond this many the oldest are forgotten
+#define MAX_FINISHED_JOBS 1024
+
+int open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    return -1;
+#endif
+}
+
+JobTable::JobTable() : epoll_fd(epoll_create1(EPOLL_CLOEXEC)), jobs(), next_id(1), num_running(0)
+{
+}
+
+JobTable::~JobTable()
+{
+    for(Job& job : jobs)
+    {
+        if(job.pidfd != -1)
+        {
+            close(job.pidfd);
+        }
+    }
+    if(epoll_fd != -1)
+    {
+        close(epoll_fd);
+    }
+}
+
+void JobTable::add(pid_t pid, const std::vector<Value>& args)
+{
+    Job job = {.id = next_id++, .pid = pid, .pidfd = -1, .command = "", .running = true, .status = 0};
+    for(std::size_t i = 0; i < args.size(); i++)
+    {
+        if(i > 0)
+        {
+            job.command += ' ';
+        }
+        job.command += args[i].str();
+    }
+    if(epoll_fd != -1)
+    {
+        job.pidfd = open_pidfd(pid);
+        if(job.pidfd != -1)
+        {
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.u64 = job.id;
+            if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, job.pidfd, &event) == -1)
+            {
+                close(job.pidfd);
+                job.pidfd = -1;
+            }
+        }
+    }
+    jobs.emplace_back(job);
+    num_running++;
+}
+
+void JobTable::finish(Job& job, int status)
+{
+    job.running = false;
+    job.status = status;
+    num_running--;
+    if(job.pidfd != -1)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, job.pidfd, NULL);
+        close(job.pidfd);
+        job.pidfd = -1;
+    }
+}
+
+// never blocks, a pidfd becomes readable once its process has exited
+// jobs without a pidfd (older kernels) fall back to a WNOHANG poll of their own pid
+void JobTable::reap()
+{
+    if(epoll_fd != -1)
+    {
+        struct epoll_event events[64];
+        int num_ready;
+        while((num_ready = epoll_wait(epoll_fd, events, 64, 0)) > 0)
+        {
+            for(int i = 0; i < num_ready; i++)
+            {
+                for(Job& job : jobs)
+                {
+                    if(job.id == events[i].data.u64 && job.running)
+                    {
+                        int status = 0;
+                        waitpid(job.pid, &status, WNOHANG);
+                        finish(job, status);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    for(Job& job : jobs)
+    {
+        if(job.running && job.pidfd == -1)
+        {
+            int status = 0;
+            pid_t res = waitpid(job.pid, &status, WNOHANG);
+            if(res == job.pid || res == -1)
+            {
+                finish(job, status);
+            }
+        }
+    }
+    std::size_t excess = jobs.size() - num_running;
+    if(excess > MAX_FINISHED_JOBS)
+    {
+        excess -= MAX_FINISHED_JOBS;
+        std::erase_if(jobs, [&excess](const Job& job)
+        {
+            if(job.running || excess == 0)
+            {
+                return false;
+            }
+            excess--;
+            return true;
+        });
+    }
+}
+
+bool JobTable::has_running() const
+{
+    return num_running > 0;
+}
+
+void JobTable::clear_finished()
+{
+    std::erase_if(jobs, [](const Job& job){ return !job.running; });
+}
+
+const std::vector<Job>& JobTable::entries() const
+{
+    return jobs;
+}
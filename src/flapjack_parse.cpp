@@ -1,12 +1,20 @@
 #include "flapjack_io.h"
 #include <flapjack_parse.h>
-#include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <cstdint>
+#include <cstdlib>
 #include <flapjack_commands.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <iterator>
 
 extern char** environ;
 
+// while background jobs are running they are reaped once every this many jumps, a power of 2
+#define JOB_REAP_INTERVAL 4096
+
+
 VarelseParser::VarelseParser() : streams(
         (TerminalStream)
         {
@@ -15,44 +23,42 @@ VarelseParser::VarelseParser() : streams(
             .stdout_append = false,
             .stderr_path = "",
             .stderr_append = false,
-        }), background(false), stack()
+        }), env(environ), stack(env), executables(env), profiling(false), executed(0), background(false)
 {
-    for(std::size_t i = 0; i < registers.size(); i++)
-    {
-        registers[i] = "";
-    }
 }
 
-static size_t parse_index(const std::string& index)
+// indices are plain decimal numbers, anything else or a number too big for std::size_t is rejected
+static bool parse_index(const std::string& index, std::size_t& res)
 {
     if(index.length() == 0)
     {
-        throw std::invalid_argument("Can't cast '" + index + "' to std::size_t");
+        return false;
     }
-    size_t res = 0;
+    res = 0;
     for(char c : index)
     {
-        std::size_t next_res = res * 10;
-        if(next_res < res)
+        if(c < '0' || c > '9' || res > (SIZE_MAX - 9) / 10)
         {
-            throw std::out_of_range("Can't cast '" + index + "' to std::size_t");
-        }
-        if(c >= '0' && c <= '9')
-        {
-            res += c - '0';
-        }
-        else
-        {
-            throw std::invalid_argument("Can't cast '" + index + "' to std::size_t");
+            return false;
         }
+        res = res * 10 + (c - '0');
     }
-    return res;
+    return true;
+}
+
+std::vector<std::string> VarelseParser::split_line(std::string_view text)
+{
+    bool terminated;
+    return split_line(text, terminated);
 }
 
-std::vector<std::string> VarelseParser::split_line(const std::string& text)
+// terminated is set to false when the line ends inside a quote
+// a pair of quotes always makes a word, even an empty one
+std::vector<std::string> VarelseParser::split_line(std::string_view text, bool& terminated)
 {
     std::vector<std::string> res;
     std::string word = "";
+    bool quoted = false;
     bool in_quotes = false;
     char quote = 0;
     bool escape = false;
@@ -109,6 +115,7 @@ std::vector<std::string> VarelseParser::split_line(const std::string& text)
                {
                    quote = 0;
                    in_quotes = false;
+                   quoted = true;
                }
                else if(text[i] == '\\')
                {
@@ -133,10 +140,11 @@ std::vector<std::string> VarelseParser::split_line(const std::string& text)
                }
                case ' ':
                {
-                   if(word.length() > 0)
+                   if(word.length() > 0 || quoted)
                    {
                        res.emplace_back(word);
                        word = "";
+                       quoted = false;
                    }
                    break;
                }
@@ -154,526 +162,852 @@ std::vector<std::string> VarelseParser::split_line(const std::string& text)
            }
        }
     }
-    if(word.length() > 0)
+    if(word.length() > 0 || quoted || in_quotes)
     {
         res.emplace_back(word);
     }
+    terminated = !in_quotes;
     return res;
 }
 
 bool VarelseParser::get_reg_arg(const std::string& index, std::size_t& arg)
 {
-    try
+    return parse_index(index, arg) && arg < registers.size();
+}
+
+void VarelseParser::get_command_args(const Instruction& instruction, std::vector<Value>& args)
+{
+    args.clear();
+    for(std::size_t reg : instruction.regs)
     {
-        arg = parse_index(index);
-        return true;
+        args.emplace_back(registers[reg]);
     }
-    catch(...)
+}
+
+void VarelseParser::get_pipeline_args(const Instruction& instruction, std::vector<std::vector<Value>>& commands)
+{
+    commands.resize(instruction.groups.size());
+    std::size_t reg = 0;
+    for(std::size_t i = 0; i < instruction.groups.size(); i++)
     {
-        return false;
+        commands[i].clear();
+        for(std::size_t j = 0; j < instruction.groups[i]; j++, reg++)
+        {
+            commands[i].emplace_back(registers[instruction.regs[reg]]);
+        }
     }
 }
 
-bool VarelseParser::get_command_args(const std::vector<std::string>& line, std::vector<std::string>& args)
+std::size_t VarelseParser::intern_literal(std::string_view literal)
 {
-    std::vector<std::string> res;
-    for(size_t i = 0; i < line.size() - 1; i++)
+    std::string key(literal);
+    auto found = literal_ids.find(key);
+    if(found != literal_ids.end())
+    {
+        return found->second;
+    }
+    literals.emplace_back(key);
+    literal_ids.emplace(std::move(key), literals.size() - 1);
+    return literals.size() - 1;
+}
+
+Instruction VarelseParser::invalid_line(OpCode op, const std::string& message)
+{
+    Instruction res = {.op = op, .regs = {}, .literal = intern_literal(message), .groups = {}, .jump_label = {}, .jump_target = 0};
+    return res;
+}
+
+// only built for error messages so well formed lines never copy their text
+static std::string quote_line(std::string_view text)
+{
+    return "'" + std::string(text) + "'";
+}
+
+// decodes a line once so executing it needs no tokenising or index parsing
+// lines which are malformed become INVALID or UNKNOWN with the message verify reports as their literal,
+// and the text of '.' lines is kept as their literal for error messages
+Instruction VarelseParser::compile_line(std::string_view text)
+{
+    Instruction res = {.op = OpCode::NOP, .regs = {}, .literal = 0, .groups = {}, .jump_label = {}, .jump_target = 0};
+    bool terminated;
+    std::vector<std::string> line = split_line(text, terminated);
+    if(!terminated)
+    {
+        return invalid_line(OpCode::INVALID, "Unterminated quote in " + quote_line(text));
+    }
+    if(line.size() == 0)
+    {
+        return res;
+    }
+    const std::string op = line.back();
+    if(op.length() != 1)
+    {
+        return invalid_line(OpCode::UNKNOWN, "Unknown command '" + op + "'");
+    }
+    std::size_t num_args = line.size() - 1;
+    bool valid;
+    switch(op[0])
+    {
+        case ';':
+        case '+':
+        case '/':
+        {
+            valid = num_args == 2;
+            break;
+        }
+        case ':':
+        {
+            valid = num_args == 2;
+            if(valid)
+            {
+                res.literal = intern_literal(line[1]);
+                num_args = 1;
+            }
+            break;
+        }
+        case '<':
+        {
+            valid = num_args == 1;
+            if(valid)
+            {
+                res.literal = intern_literal(line[0]);
+                num_args = 0;
+            }
+            break;
+        }
+        case '>':
+        case ',':
+        case '!':
+        {
+            valid = num_args == 1 || num_args == 2;
+            break;
+        }
+        case '*':
+        case '`':
+        {
+            valid = num_args >= 2;
+            break;
+        }
+        case '#':
+        case '^':
+        case '.':
+        {
+            valid = num_args >= 1;
+            break;
+        }
+        case '@':
+        case '(':
+        case ']':
+        case '[':
+        {
+            valid = num_args <= 1;
+            break;
+        }
+        case '_':
+        case '\\':
+        {
+            valid = true;
+            break;
+        }
+        case '|':
+        {
+            // stages are separated by '|' tokens which are dropped once the group sizes are known
+            std::vector<std::string> regs;
+            res.groups.emplace_back(0);
+            for(std::size_t i = 0; i < num_args; i++)
+            {
+                if(line[i] == "|")
+                {
+                    res.groups.emplace_back(0);
+                }
+                else
+                {
+                    regs.emplace_back(line[i]);
+                    res.groups.back()++;
+                }
+            }
+            valid = true;
+            for(std::size_t group : res.groups)
+            {
+                valid = valid && group > 0;
+            }
+            line = regs;
+            num_args = regs.size();
+            break;
+        }
+        case ')':
+        case '$':
+        case '&':
+        case '%':
+        case '=':
+        case '-':
+        case '}':
+        case '{':
+        case '~':
+        case '?':
+        {
+            valid = num_args == 0;
+            break;
+        }
+        default:
+        {
+            return invalid_line(OpCode::UNKNOWN, "Unknown command '" + op + "'");
+        }
+    }
+    res.op = static_cast<OpCode>(op[0]);
+    if(!valid)
+    {
+        return invalid_line(OpCode::INVALID, "Wrong number of operands for '" + op + "' in " + quote_line(text));
+    }
+    res.regs.reserve(num_args);
+    for(std::size_t i = 0; i < num_args; i++)
     {
         std::size_t index;
-        if(get_reg_arg(line[i], index))
+        if(!get_reg_arg(line[i], index))
         {
-            res.emplace_back(registers[index]);
+            return invalid_line(OpCode::INVALID, "'" + line[i] + "' is not a register (0 to " + std::to_string(registers.size() - 1) + ") in " + quote_line(text));
         }
-        else
+        res.regs.emplace_back(index);
+    }
+    if(res.op == OpCode::POP)
+    {
+        res.literal = intern_literal(text);
+    }
+    return res;
+}
+
+void VarelseParser::add_line(std::string_view text)
+{
+    program.emplace_back(compile_line(text));
+    if(program.back().op == OpCode::LABEL)
+    {
+        labels.emplace(literals[program.back().literal].str(), program.size());
+    }
+}
+
+// reports every malformed line from start onwards, along with jumps through a label that doesn't exist,
+// and turns the malformed lines into NOPs so execution never has to check for them
+// jumps whose label is known are pre-resolved, see resolve_jump
+bool VarelseParser::verify(TerminalIO& terminal, std::size_t start)
+{
+    bool valid = true;
+    for(std::size_t i = start; i < program.size(); i++)
+    {
+        Instruction& instruction = program[i];
+        if(instruction.op == OpCode::INVALID || instruction.op == OpCode::UNKNOWN)
+        {
+            terminal.print_error("Line %zu: %s\r\n", i + 1, literals[instruction.literal].c_str());
+            instruction.op = OpCode::NOP;
+            valid = false;
+        }
+        else if(instruction.op == OpCode::JUMP)
+        {
+            std::size_t literal;
+            if(find_jump_literal(i, literal))
+            {
+                if(!resolve_jump(instruction, literal))
+                {
+                    terminal.print_error("Line %zu: Jump to unknown label '%s'\r\n", i + 1, literals[literal].c_str());
+                    valid = false;
+                }
+            }
+        }
+    }
+    return valid;
+}
+
+std::size_t VarelseParser::size() const
+{
+    return program.size();
+}
+
+// whether running instruction could change register reg
+static bool writes_register(const Instruction& instruction, std::size_t reg)
+{
+    switch(instruction.op)
+    {
+        case OpCode::MOVE:
+        case OpCode::LOAD:
+        case OpCode::PEEK:
+        {
+            return instruction.regs[0] == reg;
+        }
+        case OpCode::ENV_GET:
+        {
+            return instruction.regs[1] == reg;
+        }
+        case OpCode::CAPTURE:
+        {
+            return instruction.regs[0] == reg || reg == 0;
+        }
+        case OpCode::POP:
+        {
+            return std::find(instruction.regs.begin(), instruction.regs.end(), reg) != instruction.regs.end();
+        }
+        case OpCode::EXEC:
+        case OpCode::PIPELINE:
+        case OpCode::WALK:
+        case OpCode::PARALLEL:
+        {
+            return reg == 0;
+        }
+        default:
+        {
+            return false;
+        }
+    }
+}
+
+// finds the literal a jump's register must hold, which is known when the register was last set by a ':'
+// in the same straight run of code as nothing else can reach the jump in between
+bool VarelseParser::find_jump_literal(std::size_t index, std::size_t& literal)
+{
+    std::size_t reg = program[index].regs[0];
+    for(std::size_t i = index; i > 0; i--)
+    {
+        const Instruction& previous = program[i - 1];
+        if(previous.op == OpCode::LABEL || previous.op == OpCode::JUMP)
         {
             return false;
         }
+        if(writes_register(previous, reg))
+        {
+            literal = previous.literal;
+            return previous.op == OpCode::LOAD;
+        }
+    }
+    return false;
+}
+
+// fills the jump's cache with the label it will always go through, returns false if there is no such label
+bool VarelseParser::resolve_jump(Instruction& jump, std::size_t literal)
+{
+    auto label = labels.find(literals[literal].str());
+    if(label == labels.end())
+    {
+        return false;
     }
-    args = res;
+    jump.jump_label = literals[literal];
+    jump.jump_target = label->second;
     return true;
 }
 
-void VarelseParser::parse(TerminalIO& terminal, std::string& current_dir, const std::vector<std::string>& lines, std::size_t ip)
+// handlers are reached with computed gotos (a gcc and clang extension) and each ends in its own copy of the
+// dispatch code, so the branch predictor sees which handler tends to follow which rather than one shared jump
+#define DISPATCH_CURRENT() \
+    do \
+    { \
+        if(ip >= program.size() || terminal.should_quit()) \
+        { \
+            return; \
+        } \
+        instruction = &program[ip]; \
+        profiled = profiling; \
+        line = ip; \
+        start = profiled ? Profiler::now() : 0; \
+        executed++; \
+        goto *handlers[static_cast<unsigned char>(instruction->op)]; \
+    } while(0)
+
+#define DISPATCH_NEXT() \
+    do \
+    { \
+        if(profiled) \
+        { \
+            profiler.record(line, static_cast<char>(instruction->op), Profiler::now() - start); \
+        } \
+        ip++; \
+        DISPATCH_CURRENT(); \
+    } while(0)
+
+void VarelseParser::parse(TerminalIO& terminal, std::string& current_dir, std::size_t ip)
 {
-    std::unordered_map<std::string, size_t> labels;
-    for(size_t i = 0; i < lines.size(); i++)
+    std::vector<Value> cmd_args;
+    std::vector<std::vector<Value>> pipeline_args;
+    std::vector<Value> popped;
+    std::size_t jumps = 0;
+    jobs.reap();
+    const void* handlers[128];
+    std::fill(std::begin(handlers), std::end(handlers), &&op_unknown);
+    handlers[static_cast<unsigned char>(OpCode::NOP)] = &&op_nop;
+    handlers[static_cast<unsigned char>(OpCode::LABEL)] = &&op_nop;
+    handlers[static_cast<unsigned char>(OpCode::INVALID)] = &&op_invalid;
+    handlers[static_cast<unsigned char>(OpCode::UNKNOWN)] = &&op_unknown;
+    handlers[static_cast<unsigned char>(OpCode::MOVE)] = &&op_move;
+    handlers[static_cast<unsigned char>(OpCode::LOAD)] = &&op_load;
+    handlers[static_cast<unsigned char>(OpCode::JUMP)] = &&op_jump;
+    handlers[static_cast<unsigned char>(OpCode::EXEC)] = &&op_exec;
+    handlers[static_cast<unsigned char>(OpCode::CAPTURE)] = &&op_capture;
+    handlers[static_cast<unsigned char>(OpCode::PIPELINE)] = &&op_pipeline;
+    handlers[static_cast<unsigned char>(OpCode::CHANGE_DIR)] = &&op_change_dir;
+    handlers[static_cast<unsigned char>(OpCode::DIR)] = &&op_dir;
+    handlers[static_cast<unsigned char>(OpCode::CLEAR)] = &&op_clear;
+    handlers[static_cast<unsigned char>(OpCode::PRINT)] = &&op_print;
+    handlers[static_cast<unsigned char>(OpCode::EXIT)] = &&op_exit;
+    handlers[static_cast<unsigned char>(OpCode::DISPLAY)] = &&op_display;
+    handlers[static_cast<unsigned char>(OpCode::STDIN)] = &&op_stdin;
+    handlers[static_cast<unsigned char>(OpCode::STDOUT)] = &&op_stdout;
+    handlers[static_cast<unsigned char>(OpCode::STDOUT_APPEND)] = &&op_stdout_append;
+    handlers[static_cast<unsigned char>(OpCode::STDERR)] = &&op_stderr;
+    handlers[static_cast<unsigned char>(OpCode::STDERR_APPEND)] = &&op_stderr_append;
+    handlers[static_cast<unsigned char>(OpCode::BACKGROUND)] = &&op_background;
+    handlers[static_cast<unsigned char>(OpCode::ENV_DISPLAY)] = &&op_env_display;
+    handlers[static_cast<unsigned char>(OpCode::ENV_SET)] = &&op_env_set;
+    handlers[static_cast<unsigned char>(OpCode::ENV_GET)] = &&op_env_get;
+    handlers[static_cast<unsigned char>(OpCode::PUSH)] = &&op_push;
+    handlers[static_cast<unsigned char>(OpCode::POP)] = &&op_pop;
+    handlers[static_cast<unsigned char>(OpCode::PEEK)] = &&op_peek;
+    handlers[static_cast<unsigned char>(OpCode::WALK)] = &&op_walk;
+    handlers[static_cast<unsigned char>(OpCode::PARALLEL)] = &&op_parallel;
+    handlers[static_cast<unsigned char>(OpCode::CLEAR_EXECUTABLES)] = &&op_clear_executables;
+    handlers[static_cast<unsigned char>(OpCode::JOBS)] = &&op_jobs;
+    handlers[static_cast<unsigned char>(OpCode::PROFILE)] = &&op_profile;
+    Instruction* instruction;
+    // '%' can switch profiling mid instruction so whether one is timed is decided before it runs
+    bool profiled;
+    std::size_t line;
+    std::uint64_t start;
+    DISPATCH_CURRENT();
+    op_nop:
+    {
+        DISPATCH_NEXT();
+    }
+    op_invalid:
+    op_unknown:
+    {
+        // only reached by code which hasn't been through verify
+        terminal.print_error("%s\r\n", literals[instruction->literal].c_str());
+        DISPATCH_NEXT();
+    }
+    op_move:
+    {
+        registers[instruction->regs[0]] = registers[instruction->regs[1]];
+        DISPATCH_NEXT();
+    }
+    op_load:
     {
-        if(lines[i].ends_with('<'))
+        registers[instruction->regs[0]] = literals[instruction->literal];
+        DISPATCH_NEXT();
+    }
+    op_jump:
+    {
+        // labels are never redefined so a cached target stays right for as long as the same value is jumped through
+        const Value& loc = registers[instruction->regs[0]];
+        if(instruction->jump_target == 0 || !loc.same(instruction->jump_label))
         {
-            std::vector<std::string> line = split_line(lines[i]);
-            std::string op = line.back(); 
-            if(op.length() == 1)
+            auto label = labels.find(loc.str());
+            if(label == labels.end())
             {
-                if(line.size() == 2)
-                {
-                    labels.emplace(line[0], i + 1);
-                }
-                else
-                {
-                    terminal.print_error("Invalid instruction '%s'\r\n", lines[i].c_str());
-                }
+                terminal.print_error("Invalid jump location '%s'\r\n", loc.c_str());
+                DISPATCH_NEXT();
+            }
+            instruction->jump_label = loc;
+            instruction->jump_target = label->second;
+        }
+        if(instruction->regs.size() == 1 || registers[instruction->regs[1]].length() > 0)
+        {
+            ip = instruction->jump_target - 1; // will add 1 when dispatching
+            // a loop that never launches anything would otherwise leave finished jobs unreaped
+            if(jobs.has_running() && (++jumps & (JOB_REAP_INTERVAL - 1)) == 0)
+            {
+                jobs.reap();
             }
         }
+        DISPATCH_NEXT();
+    }
+    op_exec:
+    {
+        get_command_args(*instruction, cmd_args);
+        registers[0] = std::to_string(exec_process(terminal, env, executables, jobs, background, cmd_args, streams));
+        if(profiled)
+        {
+            profiler.record_program(cmd_args[0].str(), Profiler::now() - start);
+        }
+        DISPATCH_NEXT();
     }
-    for(;ip < lines.size() && !terminal.should_quit(); ip++)
+    op_capture:
     {
-        std::vector<std::string> line = split_line(lines[ip]);
-        if(line.size() > 0)
+        // the first register receives the output and the rest make up the command
+        cmd_args.clear();
+        for(std::size_t i = 1; i < instruction->regs.size(); i++)
         {
-            std::string op = line.back(); 
-            if(op.length() != 1)
+            cmd_args.emplace_back(registers[instruction->regs[i]]);
+        }
+        std::string output;
+        int status = capture_process(terminal, env, executables, jobs, cmd_args, streams, output);
+        registers[instruction->regs[0]] = Value(std::move(output));
+        registers[0] = std::to_string(status);
+        if(profiled)
+        {
+            profiler.record_program(cmd_args[0].str(), Profiler::now() - start);
+        }
+        DISPATCH_NEXT();
+    }
+    op_parallel:
+    {
+        // the first register holds how many jobs may run at once and the rest make up the command
+        // every value on the stack is run as the command's last argument and replaced by its job's status
+        std::size_t max_jobs;
+        if(!parse_index(registers[instruction->regs[0]].str(), max_jobs) || max_jobs == 0)
+        {
+            terminal.print_error("'%s' is not a number of jobs\r\n", registers[instruction->regs[0]].c_str());
+            DISPATCH_NEXT();
+        }
+        cmd_args.clear();
+        for(std::size_t i = 1; i < instruction->regs.size(); i++)
+        {
+            cmd_args.emplace_back(registers[instruction->regs[i]]);
+        }
+        std::vector<Value> items;
+        if(!stack.pop_many(stack.size(), items))
+        {
+            terminal.print_error("Unable to read the stack back from disk\r\n");
+            DISPATCH_NEXT();
+        }
+        std::vector<int> statuses;
+        registers[0] = std::to_string(exec_parallel(terminal, env, executables, jobs, max_jobs, cmd_args, items, streams, statuses));
+        items.clear();
+        for(int status : statuses)
+        {
+            items.emplace_back(std::to_string(status));
+        }
+        stack.push_many(items);
+        if(profiled)
+        {
+            profiler.record_program(cmd_args[0].str(), Profiler::now() - start);
+        }
+        DISPATCH_NEXT();
+    }
+    op_pipeline:
+    {
+        get_pipeline_args(*instruction, pipeline_args);
+        registers[0] = std::to_string(exec_pipeline(terminal, env, executables, jobs, background, pipeline_args, streams));
+        if(profiled)
+        {
+            std::string name;
+            for(const std::vector<Value>& command : pipeline_args)
             {
-                terminal.print_error("Unknown command '%s'\r\n", op.c_str());
+                name += (name.length() > 0 ? " | " : "") + command[0].str();
+            }
+            profiler.record_program(name, Profiler::now() - start);
+        }
+        DISPATCH_NEXT();
+    }
+    op_change_dir:
+    {
+        get_command_args(*instruction, cmd_args);
+        cd_cmd(terminal, env, current_dir, cmd_args);
+        DISPATCH_NEXT();
+    }
+    op_dir:
+    {
+        get_command_args(*instruction, cmd_args);
+        dir_cmd(terminal, current_dir, cmd_args);
+        DISPATCH_NEXT();
+    }
+    op_clear:
+    {
+        terminal.print("\033[2J\033[H");
+        DISPATCH_NEXT();
+    }
+    op_print:
+    {
+        if(instruction->regs.size() != 0)
+        {
+            for(std::size_t i = 0; i < instruction->regs.size() - 1; i++)
+            {
+                terminal.print("%s ", registers[instruction->regs[i]].c_str());
+            }
+            terminal.print("%s", registers[instruction->regs.back()].c_str());
+        }
+        terminal.print("\r\n");
+        DISPATCH_NEXT();
+    }
+    op_exit:
+    {
+        if(profiling)
+        {
+            profiler.report(terminal);
+        }
+        terminal.flush();
+        exit(0);
+    }
+    op_display:
+    {
+        terminal.set_text_colour(stdout, TerminalColour::LIGHT_PURPLE);
+        terminal.print("Background: %s\r\n", background ? "true" : "false");
+        terminal.set_text_colour(stdout, TerminalColour::LIGHT_GREEN);
+        terminal.print("Stdio\r\n");
+        if(streams.stdin_path.length() > 0)
+        {
+            terminal.print("\t[r] stdin:  '%s'\r\n", streams.stdin_path.c_str());
+        }
+        else
+        {
+            terminal.print("\t[r] stdin:  default\r\n");
+        }
+        if(streams.stdout_path.length() > 0)
+        {
+            terminal.print("\t[%c] stdout: '%s'\r\n", streams.stdout_append ? 'a' : 'w', streams.stdout_path.c_str());
+        }
+        else
+        {
+            terminal.print("\t[%c] stdout: default\r\n", streams.stdout_append ? 'a' : 'w');
+        }
+        if(streams.stderr_path.length() > 0)
+        {
+            terminal.print("\t[%c] stderr: '%s'\r\n", streams.stderr_append ? 'a' : 'w', streams.stderr_path.c_str());
+        }
+        else
+        {
+            terminal.print("\t[%c] stderr: default\r\n", streams.stderr_append ? 'a' : 'w');
+        }
+        terminal.set_text_colour(stdout, TerminalColour::LIGHT_BLUE);
+        terminal.print("Registers\r\n");
+        for(std::size_t i = 0; i < registers.size(); i++)
+        {
+            terminal.print("\t[%zu] \'%s\'\r\n", i, registers[i].c_str());
+        }
+        if(stack.size() > 0) {
+            terminal.set_text_colour(stdout, TerminalColour::LIGHT_RED);
+            terminal.print("Stack\r\n");
+            std::size_t power = 0;
+            std::size_t len = stack.size() - 1;
+            while(len > 0)
+            {
+                power++;
+                len /= 10;
+            }
+            if(stack.size() == 1)
+            {
+                power = 1;
+            }
+            Value value;
+            for(std::size_t i = 0; i < stack.size() && stack.peek(i, value); i++) {
+                terminal.print("\t[%*zu] \'%s\'\r\n", (int)power, i, value.c_str());
+            }
+        }
+        if(executables.entries().size() > 0)
+        {
+            terminal.set_text_colour(stdout, TerminalColour::LIGHT_YELLOW);
+            terminal.print("Executables\r\n");
+            for(const auto& [name, path] : executables.entries())
+            {
+                terminal.print("\t%s: '%s'\r\n", name.c_str(), path.c_str());
+            }
+        }
+        terminal.reset_text_colour(stdout);
+        DISPATCH_NEXT();
+    }
+    op_stdin:
+    {
+        streams.stdin_path = instruction->regs.size() == 0 ? "" : registers[instruction->regs[0]].str();
+        DISPATCH_NEXT();
+    }
+    op_stdout:
+    {
+        streams.stdout_path = instruction->regs.size() == 0 ? "" : registers[instruction->regs[0]].str();
+        DISPATCH_NEXT();
+    }
+    op_stdout_append:
+    {
+        streams.stdout_append = !streams.stdout_append;
+        DISPATCH_NEXT();
+    }
+    op_stderr:
+    {
+        streams.stderr_path = instruction->regs.size() == 0 ? "" : registers[instruction->regs[0]].str();
+        DISPATCH_NEXT();
+    }
+    op_stderr_append:
+    {
+        streams.stderr_append = !streams.stderr_append;
+        DISPATCH_NEXT();
+    }
+    op_background:
+    {
+        background = !background;
+        DISPATCH_NEXT();
+    }
+    op_env_display:
+    {
+        // the environment is kept in hash order so it is sorted by name for display
+        std::vector<const std::pair<const std::string, std::string>*> sorted_env;
+        sorted_env.reserve(env.entries().size());
+        for(const auto& entry : env.entries())
+        {
+            sorted_env.push_back(&entry);
+        }
+        std::sort(sorted_env.begin(), sorted_env.end(), [](const auto* a, const auto* b)
+        {
+            return a->first < b->first;
+        });
+        for(const auto* entry : sorted_env)
+        {
+            terminal.print("%s=%s\r\n", entry->first.c_str(), entry->second.c_str());
+        }
+        DISPATCH_NEXT();
+    }
+    op_env_set:
+    {
+        if(!env.set(registers[instruction->regs[0]].str(), registers[instruction->regs[1]].str()))
+        {
+            terminal.print_error("Unable to set environment variable '%s'\r\n", registers[instruction->regs[0]].c_str());
+        }
+        DISPATCH_NEXT();
+    }
+    op_env_get:
+    {
+        const std::string* res = env.get(registers[instruction->regs[0]].str());
+        if(res == NULL)
+        {
+            terminal.print_error("Unable to get environment variable '%s'\r\n", registers[instruction->regs[0]].c_str());
+        }
+        else
+        {
+            registers[instruction->regs[1]] = *res;
+        }
+        DISPATCH_NEXT();
+    }
+    op_push:
+    {
+        for(std::size_t reg : instruction->regs)
+        {
+            stack.push(registers[reg]);
+        }
+        DISPATCH_NEXT();
+    }
+    op_pop:
+    {
+        std::size_t count = instruction->regs.size();
+        if(stack.size() < count)
+        {
+            terminal.print_error("Invalid instruction '%s'\r\n", literals[instruction->literal].c_str());
+        }
+        else if(!stack.pop_many(count, popped))
+        {
+            terminal.print_error("Unable to read the stack back from disk for '%s'\r\n", literals[instruction->literal].c_str());
+        }
+        else
+        {
+            // the first register gets the top of the stack
+            for(std::size_t i = 0; i < count; i++)
+            {
+                registers[instruction->regs[i]] = std::move(popped[count - 1 - i]);
+            }
+        }
+        DISPATCH_NEXT();
+    }
+    op_peek:
+    {
+        if(instruction->regs.size() == 1)
+        {
+            registers[instruction->regs[0]] = std::to_string(stack.size());
+        }
+        else
+        {
+            std::size_t index;
+            Value value;
+            if(parse_index(registers[instruction->regs[1]].str(), index) && stack.peek(index, value))
+            {
+                registers[instruction->regs[0]] = value;
             }
             else
             {
-                switch(op[0])
-                {
-                    case ';':
-                    {
-                        std::size_t arg1;
-                        std::size_t arg2;
-                        if(line.size() == 3 && get_reg_arg(line[0], arg1) && get_reg_arg(line[1], arg2))
-                        {
-                            registers[arg1] = registers[arg2];
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case ':':
-                    {
-                        std::size_t arg1;
-                        if(line.size() == 3 && get_reg_arg(line[0], arg1))
-                        {
-                            registers[arg1] = line[1];
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case '<':
-                    {
-                        break;
-                    }
-                    case '>':
-                    {
-                        std::size_t arg1;
-                        std::size_t arg2;
-                        if(line.size() == 2 && get_reg_arg(line[0], arg1))
-                        {
-                            std::string loc = registers[arg1];
-                            if(labels.find(loc) != labels.end())
-                            {
-                                ip = labels.at(loc) - 1; // will add 1 at end of loop
-                            }
-                            else
-                            {
-                                terminal.print_error("Invalid jump location '%s'\r\n", loc.c_str());
-                            }
-                        }
-                        else if(line.size() == 3 && get_reg_arg(line[0], arg1) && get_reg_arg(line[1], arg2))
-                        {
-                            std::string loc = registers[arg1];
-                            if(labels.find(loc) != labels.end())
-                            {
-                                if(registers[arg2].length() > 0)
-                                {
-                                    ip = labels.at(loc) - 1;    
-                                }
-                            }
-                            else
-                            {
-                                terminal.print_error("Invalid jump location '%s'\r\n", loc.c_str());
-                            }
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case '#':
-                    {
-                        if(line.size() < 2)
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        else
-                        {
-                            std::vector<std::string> cmd_args;
-                            if(get_command_args(line, cmd_args))
-                            {
-                                registers[0] = std::to_string(exec_process(terminal, background, cmd_args, streams));
-                            }
-                            else
-                            {
-                                terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                            }
-                        }
-                        break;
-                    }
-                    case '@':
-                    {
-                        std::vector<std::string> args;
-                        if(line.size() == 2)
-                        {
-                            std::size_t arg1;
-                            if(line.size() == 2 && get_reg_arg(line[0], arg1))
-                            {
-                                args.emplace_back(registers[arg1]);
-                                cd_cmd(terminal, current_dir, args);
-                            }
-                            else
-                            {
-                                terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                            }
-                        }
-                        else if(line.size() == 1)
-                        {
-                            cd_cmd(terminal, current_dir, args);
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case '_':
-                    {
-                        std::vector<std::string> cmd_args;
-                        if(get_command_args(line, cmd_args))
-                        {
-                            dir_cmd(terminal, current_dir, cmd_args);
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case ')':
-                    {
-                        if(line.size() == 1)
-                        {
-                            terminal.print("\033[2J\033[H");
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case '\\':
-                    {
-                        std::vector<std::string> cmd_args;
-                        if(get_command_args(line, cmd_args))
-                        {
-                            if(cmd_args.size() != 0)
-                            {
-                                for(std::size_t i = 0; i < cmd_args.size() - 1; i++)
-                                {
-                                    terminal.print("%s ", cmd_args[i].c_str());
-                                }
-                                terminal.print(cmd_args.back().c_str());
-                            }
-                            terminal.print("\r\n");
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case '=':
-                    {
-                        if(line.size() == 1)
-                        {
-                            exit(0);
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case '-':
-                    {
-                        if(line.size() == 1)
-                        {
-                            terminal.set_text_colour(stdout, TerminalColour::LIGHT_PURPLE);
-                            terminal.print("Background: %s\r\n", background ? "true" : "false");
-                            terminal.set_text_colour(stdout, TerminalColour::LIGHT_GREEN);
-                            terminal.print("Stdio\r\n");
-                            if(streams.stdin_path.length() > 0)
-                            {
-                                terminal.print("\t[r] stdin:  '%s'\r\n", streams.stdin_path.c_str());
-                            }
-                            else
-                            {
-                                terminal.print("\t[r] stdin:  default\r\n");
-                            }
-                            if(streams.stdout_path.length() > 0)
-                            {
-                                terminal.print("\t[%c] stdout: '%s'\r\n", streams.stdout_append ? 'a' : 'w', streams.stdout_path.c_str());
-                            }
-                            else
-                            {
-                                terminal.print("\t[%c] stdout: default\r\n", streams.stdout_append ? 'a' : 'w');
-                            }
-                            if(streams.stderr_path.length() > 0)
-                            {
-                                terminal.print("\t[%c] stderr: '%s'\r\n", streams.stderr_append ? 'a' : 'w', streams.stderr_path.c_str());
-                            }
-                            else
-                            {
-                                terminal.print("\t[%c] stderr: default\r\n", streams.stderr_append ? 'a' : 'w');
-                            }
-                            terminal.set_text_colour(stdout, TerminalColour::LIGHT_BLUE);
-                            terminal.print("Registers\r\n");
-                            for(std::size_t i = 0; i < registers.size(); i++)
-                            {
-                                terminal.print("\t[%zu] \'%s\'\r\n", i, registers[i].c_str());
-                            }
-                            if(stack.size() > 0) {
-                                terminal.set_text_colour(stdout, TerminalColour::LIGHT_RED);
-                                terminal.print("Stack\r\n");
-                                std::size_t power = 0;
-                                std::size_t len = stack.size() - 1;
-                                while(len > 0)
-                                {
-                                    power++;
-                                    len /= 10;
-                                }
-                                if(stack.size() == 1)
-                                {
-                                    power = 1;
-                                }
-                                for(std::size_t i = 0; i < stack.size(); i++) {
-                                    terminal.print("\t[%*zu] \'%s\'\r\n", (int)power, i, stack[i].c_str());
-                                }
-                            }
-                            terminal.reset_text_colour(stdout);
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case '(':
-                    {
-                        std::size_t arg1;
-                        if(line.size() == 1)
-                        {
-                            streams.stdin_path = "";
-                        }
-                        else if(line.size() == 2 && get_reg_arg(line[0], arg1))
-                        {
-                            streams.stdin_path = registers[arg1];
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case ']':
-                    {
-                        std::size_t arg1;
-                        if(line.size() == 1)
-                        {
-                            streams.stdout_path = "";
-                        }
-                        else if(line.size() == 2 && get_reg_arg(line[0], arg1))
-                        {
-                            streams.stdout_path = registers[arg1];
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case '}':
-                    {
-                        if(line.size() == 1)
-                        {
-                            streams.stdout_append = !streams.stdout_append;
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case '[':
-                    {
-                        std::size_t arg1;
-                        if(line.size() == 1)
-                        {
-                            streams.stderr_path = "";
-                        }
-                        else if(line.size() == 2 && get_reg_arg(line[0], arg1))
-                        {
-                            streams.stderr_path = registers[arg1];
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case '{':
-                    {
-                        if(line.size() == 1)
-                        {
-                            streams.stderr_append = !streams.stderr_append;
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case '~':
-                    {
-                        if(line.size() == 1)
-                        {
-                            background = !background;
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case '?':
-                    {
-                        if(line.size() == 1)
-                        {
-                            for(size_t i = 0; environ[i] != 0; i++)
-                            {
-                                terminal.print("%s\r\n", environ[i]);
-                            }
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case '+':
-                    {
-                        size_t arg1;
-                        size_t arg2;
-                        if(line.size() == 3 && get_reg_arg(line[0], arg1) && get_reg_arg(line[1], arg2))
-                        {
-                            if(setenv(registers[arg1].c_str(), registers[arg2].c_str(), true) != 0)
-                            {
-                                terminal.print_error("Unable to set environment variable '%s'\r\n", registers[arg1].c_str());
-                            }
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case '/':
-                    {
-                        size_t arg1;
-                        size_t arg2;
-                        if(line.size() == 3 && get_reg_arg(line[0], arg1) && get_reg_arg(line[1], arg2))
-                        {
-                            char* res = getenv(registers[arg1].c_str());
-                            if(res == NULL)
-                            {
-                                terminal.print_error("Unable to set environment variable '%s'\r\n", registers[arg1].c_str());
-                            }
-                            else
-                            {
-                                registers[arg2] = res;
-                            }
-                        }
-                        else
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        break;
-                    }
-                    case '^':
-                    {
-                        if(line.size() < 2)
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        else
-                        {
-                            std::vector<std::string> values;
-                            if(get_command_args(line, values))
-                            {
-                                for(std::size_t i = 0; i < values.size(); i++)
-                                {
-                                    stack.emplace_back(values[i]);
-                                }
-                            }
-                            else
-                            {
-                                terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                            }
-                        }
-                        break;
-                    }
-                    case '.':
-                    {
-                        if(line.size() < 2)
-                        {
-                            terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                        }
-                        else
-                        {
-                            std::vector<std::size_t> reg;
-                            bool error = false;
-                            for(std::size_t i = 0; i < line.size() - 1; i++)
-                            {
-                                size_t arg;
-                                if(get_reg_arg(line[i], arg))
-                                {
-                                    reg.emplace_back(arg);
-                                }
-                                else
-                                {
-                                    error = true;
-                                    break;
-                                }
-                            }
-                            if(error || stack.size() < reg.size())
-                            {
-                                terminal.print_error("Invalid instruction '%s'\r\n", lines[ip].c_str());
-                            }
-                            else
-                            {
-                                for(std::size_t i = 0; i < reg.size(); i++)
-                                {
-                                    registers[reg[i]] = stack[stack.size() - 1];
-                                    stack.pop_back();
-                                }
-                            }
-                        }
-                        break;
-                    }
-                    default:
-                    {
-                        terminal.print_error("Unknown command '%s'\r\n", op.c_str());
-                        break;
-                    }
-                }
+                terminal.print_error("Invalid stack index '%s'\r\n", registers[instruction->regs[1]].c_str());
+            }
+        }
+        DISPATCH_NEXT();
+    }
+    op_walk:
+    {
+        get_command_args(*instruction, cmd_args);
+        std::vector<std::string> matches;
+        long count = walk_cmd(terminal, cmd_args, streams, matches);
+        std::vector<Value> values;
+        values.reserve(matches.size());
+        for(std::string& match : matches)
+        {
+            values.emplace_back(std::move(match));
+        }
+        stack.push_many(values);
+        registers[0] = std::to_string(count);
+        DISPATCH_NEXT();
+    }
+    op_clear_executables:
+    {
+        executables.clear();
+        DISPATCH_NEXT();
+    }
+    op_jobs:
+    {
+        jobs.reap();
+        terminal.set_text_colour(stdout, TerminalColour::LIGHT_CYAN);
+        terminal.print("Jobs\r\n");
+        for(const Job& job : jobs.entries())
+        {
+            if(job.running)
+            {
+                terminal.print("\t[%zu] %d running '%s'\r\n", job.id, (int)job.pid, job.command.c_str());
             }
+            else if(WIFSIGNALED(job.status))
+            {
+                terminal.print("\t[%zu] %d killed (%d) '%s'\r\n", job.id, (int)job.pid, WTERMSIG(job.status), job.command.c_str());
+            }
+            else
+            {
+                terminal.print("\t[%zu] %d done (%d) '%s'\r\n", job.id, (int)job.pid, WEXITSTATUS(job.status), job.command.c_str());
+            }
+        }
+        terminal.reset_text_colour(stdout);
+        // finished jobs are only reported once
+        jobs.clear_finished();
+        DISPATCH_NEXT();
+    }
+    op_profile:
+    {
+        if(profiling)
+        {
+            profiler.report(terminal);
+            profiling = false;
+        }
+        else
+        {
+            profiler.clear();
+            profiling = true;
         }
+        DISPATCH_NEXT();
+    }
+}
+
+#undef DISPATCH_NEXT
+#undef DISPATCH_CURRENT
+
+ExecutableCache& VarelseParser::executable_cache()
+{
+    return executables;
+}
+
+Environment& VarelseParser::environment()
+{
+    return env;
+}
+
+std::size_t VarelseParser::instructions_executed() const
+{
+    return executed;
+}
+
+void VarelseParser::start_profiling()
+{
+    profiler.clear();
+    profiling = true;
+}
+
+void VarelseParser::report_profile(TerminalIO& terminal)
+{
+    if(profiling)
+    {
+        profiler.report(terminal);
     }
 }
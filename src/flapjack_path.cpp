@@ -0,0 +1,156 @@
+#include <flapjack_path.h>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+
+// directory mtimes are checked at most this often so a hot loop of launches doesn't stat PATH each time
+#define MTIME_CHECK_INTERVAL_NS 1000000000L
+
+static std::vector<std::string> parse_env_path(const std::string& path)
+{
+    std::vector<std::string> paths;
+    std::string path_elem;
+    for(char c : path)
+    {
+        if(c == ':')
+        {
+            if(path_elem.length() > 0)
+            {
+                paths.emplace_back(path_elem);
+            }
+            path_elem = "";
+        }
+        else
+        {
+            path_elem += c;
+        }
+    }
+    if(path_elem.length() > 0)
+    {
+        paths.emplace_back(path_elem);
+    }
+    for(std::string& dir : paths)
+    {
+        if(dir.back() != '/')
+        {
+            dir += '/';
+        }
+    }
+    return paths;
+}
+
+static struct timespec get_mtime(const std::string& dir)
+{
+    struct stat dir_state;
+    if(stat(dir.c_str(), &dir_state) == -1)
+    {
+        return (struct timespec){.tv_sec = 0, .tv_nsec = 0};
+    }
+    return dir_state.st_mtim;
+}
+
+ExecutableCache::ExecutableCache(const Environment& environment) : environment(environment), env_version(static_cast<std::size_t>(-1)), path_env(), dirs(), dir_mtimes(), paths(), last_check({.tv_sec = 0, .tv_nsec = 0})
+{
+}
+
+void ExecutableCache::validate()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    // PATH only needs comparing when some variable has changed since it was last read
+    if(env_version != environment.version())
+    {
+        env_version = environment.version();
+        const std::string* env = environment.get("PATH");
+        const std::string& new_path = env == NULL ? "" : *env;
+        if(path_env != new_path)
+        {
+            path_env = new_path;
+            dirs = parse_env_path(path_env);
+            dir_mtimes.clear();
+            for(const std::string& dir : dirs)
+            {
+                dir_mtimes.emplace_back(get_mtime(dir));
+            }
+            paths.clear();
+            dir_indexes.assign(dirs.size(), DirIndex{false, {0, 0}, {}, {}});
+            last_check = now;
+            return;
+        }
+    }
+    long elapsed = (now.tv_sec - last_check.tv_sec) * 1000000000L + (now.tv_nsec - last_check.tv_nsec);
+    if(elapsed < MTIME_CHECK_INTERVAL_NS)
+    {
+        return;
+    }
+    last_check = now;
+    for(std::size_t i = 0; i < dirs.size(); i++)
+    {
+        struct timespec mtime = get_mtime(dirs[i]);
+        if(mtime.tv_sec != dir_mtimes[i].tv_sec || mtime.tv_nsec != dir_mtimes[i].tv_nsec)
+        {
+            dir_mtimes[i] = mtime;
+            paths.clear();
+        }
+    }
+}
+
+bool ExecutableCache::resolve(const std::string& name, std::string& path)
+{
+    validate();
+    auto found = paths.find(name);
+    if(found != paths.end())
+    {
+        path = found->second;
+        return true;
+    }
+    std::string candidate;
+    for(const std::string& dir : dirs)
+    {
+        candidate = dir;
+        candidate += name;
+        if(access(candidate.c_str(), X_OK) == 0)
+        {
+            paths.emplace(name, candidate);
+            path = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ExecutableCache::clear()
+{
+    paths.clear();
+}
+
+// each directory is only listed again once its mtime changes so a Tab press costs a stat per directory
+// only names matching the prefix are checked for being executable
+void ExecutableCache::complete(const std::string& prefix, std::vector<std::string>& names)
+{
+    validate();
+    std::string candidate;
+    for(std::size_t i = 0; i < dirs.size(); i++)
+    {
+        update_dir_index(dirs[i], dir_indexes[i]);
+        std::size_t start;
+        std::size_t end;
+        find_prefix(dir_indexes[i], prefix, start, end);
+        for(std::size_t j = start; j < end; j++)
+        {
+            candidate = dirs[i];
+            candidate += dir_indexes[i].names[j];
+            if(dir_indexes[i].types[j] != DT_DIR && access(candidate.c_str(), X_OK) == 0)
+            {
+                names.emplace_back(dir_indexes[i].names[j]);
+            }
+        }
+    }
+}
+
+const std::unordered_map<std::string, std::string>& ExecutableCache::entries() const
+{
+    return paths;
+}
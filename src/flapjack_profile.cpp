@@ -0,0 +1,146 @@
+#include <flapjack_profile.h>
+#include <algorithm>
+#include <ctime>
+#include <string>
+
+// only the slowest lines are reported so the report stays readable for long scripts
+#define PROFILE_HOT_LINES 20
+
+Profiler::Profiler() : opcodes(), lines(), programs(), current_program_ns(0)
+{
+}
+
+std::uint64_t Profiler::now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (std::uint64_t)time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
+
+void Profiler::clear()
+{
+    opcodes.fill((ProfileEntry){.count = 0, .ns = 0, .program_ns = 0});
+    lines.clear();
+    programs.clear();
+    current_program_ns = 0;
+}
+
+// ns covers the whole instruction, including any program it ran
+void Profiler::record(std::size_t line, char op, std::uint64_t ns)
+{
+    std::uint64_t program_ns = std::min(current_program_ns, ns);
+    current_program_ns = 0;
+    ProfileEntry& opcode = opcodes[static_cast<unsigned char>(op)];
+    opcode.count++;
+    opcode.ns += ns - program_ns;
+    opcode.program_ns += program_ns;
+    if(line >= lines.size())
+    {
+        lines.resize(line + 1, (ProfileEntry){.count = 0, .ns = 0, .program_ns = 0});
+    }
+    lines[line].count++;
+    lines[line].ns += ns - program_ns;
+    lines[line].program_ns += program_ns;
+}
+
+void Profiler::record_program(const std::string& name, std::uint64_t ns)
+{
+    ProfileEntry& program = programs[name];
+    program.count++;
+    program.ns += ns;
+    current_program_ns += ns;
+}
+
+static void print_entry(TerminalIO& terminal, const char* name, const ProfileEntry& entry)
+{
+    if(entry.program_ns > 0)
+    {
+        terminal.print("\t[%s] %zu runs, %.3fms, %.3fms in programs\r\n", name, entry.count, entry.ns / 1e6, entry.program_ns / 1e6);
+    }
+    else
+    {
+        terminal.print("\t[%s] %zu runs, %.3fms\r\n", name, entry.count, entry.ns / 1e6);
+    }
+}
+
+static const char* opcode_name(unsigned char op)
+{
+    static char name[2] = {0, 0};
+    switch(op)
+    {
+        case 0:
+        {
+            return "empty";
+        }
+        case 1:
+        {
+            return "invalid";
+        }
+        case 2:
+        {
+            return "unknown";
+        }
+        default:
+        {
+            name[0] = op;
+            return name;
+        }
+    }
+}
+
+void Profiler::report(TerminalIO& terminal)
+{
+    std::vector<std::pair<std::size_t, ProfileEntry>> sorted;
+    for(std::size_t i = 0; i < opcodes.size(); i++)
+    {
+        if(opcodes[i].count > 0)
+        {
+            sorted.emplace_back(i, opcodes[i]);
+        }
+    }
+    auto slowest = [](const std::pair<std::size_t, ProfileEntry>& a, const std::pair<std::size_t, ProfileEntry>& b)
+    {
+        return a.second.ns + a.second.program_ns > b.second.ns + b.second.program_ns;
+    };
+    std::sort(sorted.begin(), sorted.end(), slowest);
+    terminal.set_text_colour(stdout, TerminalColour::LIGHT_PURPLE);
+    terminal.print("Opcodes\r\n");
+    for(const auto& [op, entry] : sorted)
+    {
+        print_entry(terminal, opcode_name(op), entry);
+    }
+    sorted.clear();
+    for(std::size_t i = 0; i < lines.size(); i++)
+    {
+        if(lines[i].count > 0)
+        {
+            sorted.emplace_back(i, lines[i]);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(), slowest);
+    if(sorted.size() > PROFILE_HOT_LINES)
+    {
+        sorted.resize(PROFILE_HOT_LINES);
+    }
+    terminal.set_text_colour(stdout, TerminalColour::LIGHT_GREEN);
+    terminal.print("Lines\r\n");
+    for(const auto& [line, entry] : sorted)
+    {
+        print_entry(terminal, std::to_string(line + 1).c_str(), entry);
+    }
+    if(programs.size() > 0)
+    {
+        std::vector<std::pair<std::string, ProfileEntry>> sorted_programs(programs.begin(), programs.end());
+        std::sort(sorted_programs.begin(), sorted_programs.end(), [](const auto& a, const auto& b)
+        {
+            return a.second.ns > b.second.ns;
+        });
+        terminal.set_text_colour(stdout, TerminalColour::LIGHT_BLUE);
+        terminal.print("Programs\r\n");
+        for(const auto& [name, entry] : sorted_programs)
+        {
+            terminal.print("\t[%s] %zu runs, %.3fms\r\n", name.c_str(), entry.count, entry.ns / 1e6);
+        }
+    }
+    terminal.reset_text_colour(stdout);
+}
@@ -0,0 +1,327 @@
+#include <flapjack_stack.h>
+#include <cstdint>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define STACK_CHUNK_SIZE 4096
+#define NO_CHUNK ((std::size_t)-1)
+#define DEFAULT_STACK_LIMIT (256 * 1024 * 1024)
+
+static std::size_t value_cost(const Value& value)
+{
+    return sizeof(Value) + value.length();
+}
+
+// FLAPJACK_STACK_LIMIT sets how many bytes of stack may be held in memory before spilling to disk
+static std::size_t get_stack_limit(const Environment& environment)
+{
+    const std::string* limit = environment.get("FLAPJACK_STACK_LIMIT");
+    if(limit != NULL)
+    {
+        char* end;
+        unsigned long long res = std::strtoull(limit->c_str(), &end, 10);
+        if(end != limit->c_str() && *end == 0)
+        {
+            return res;
+        }
+    }
+    return DEFAULT_STACK_LIMIT;
+}
+
+static int open_spill_file(const Environment& environment)
+{
+    const std::string* tmpdir = environment.get("TMPDIR");
+    std::string dir = tmpdir != NULL && tmpdir->length() > 0 ? *tmpdir : "/tmp";
+    int fd = open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if(fd != -1)
+    {
+        return fd;
+    }
+    // O_TMPFILE isn't supported by every filesystem
+    std::string name = dir + "/flapjack-stack-XXXXXX";
+    fd = mkostemp(name.data(), O_CLOEXEC);
+    if(fd != -1)
+    {
+        unlink(name.c_str());
+    }
+    return fd;
+}
+
+ValueStack::ValueStack(const Environment& environment) : chunks(), first_resident(0), num_values(0), resident_bytes(0),
+    environment(environment), memory_limit(get_stack_limit(environment)), limit_version(environment.version()), spill_fd(-1),
+    peek_chunk(NO_CHUNK), peek_values()
+{
+}
+
+ValueStack::~ValueStack()
+{
+    if(spill_fd != -1)
+    {
+        close(spill_fd);
+    }
+}
+
+// each value is written as its length followed by its bytes
+bool ValueStack::spill(StackChunk& chunk)
+{
+    if(spill_fd == -1)
+    {
+        spill_fd = open_spill_file(environment);
+        if(spill_fd == -1)
+        {
+            return false;
+        }
+    }
+    std::vector<char> buffer;
+    buffer.reserve(chunk.bytes);
+    for(const Value& value : chunk.values)
+    {
+        std::uint64_t length = value.length();
+        buffer.insert(buffer.end(), (const char*)&length, (const char*)&length + sizeof(length));
+        buffer.insert(buffer.end(), value.str().begin(), value.str().end());
+    }
+    chunk.offset = lseek(spill_fd, 0, SEEK_END);
+    std::size_t written = 0;
+    while(written < buffer.size())
+    {
+        ssize_t res = pwrite(spill_fd, buffer.data() + written, buffer.size() - written, chunk.offset + written);
+        if(res == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            ftruncate(spill_fd, chunk.offset);
+            return false;
+        }
+        written += res;
+    }
+    chunk.file_length = buffer.size();
+    chunk.spilled = true;
+    resident_bytes -= chunk.bytes;
+    chunk.values.clear();
+    chunk.values.shrink_to_fit();
+    return true;
+}
+
+bool ValueStack::read_chunk(const StackChunk& chunk, std::vector<Value>& values)
+{
+    std::vector<char> buffer(chunk.file_length);
+    std::size_t num_read = 0;
+    while(num_read < buffer.size())
+    {
+        ssize_t res = pread(spill_fd, buffer.data() + num_read, buffer.size() - num_read, chunk.offset + num_read);
+        if(res == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if(res <= 0)
+        {
+            return false;
+        }
+        num_read += res;
+    }
+    // anything that doesn't decode to exactly the values written is treated as a failed read
+    std::vector<Value> res;
+    res.reserve(chunk.count);
+    std::size_t pos = 0;
+    while(pos + sizeof(std::uint64_t) <= buffer.size())
+    {
+        std::uint64_t length;
+        std::memcpy(&length, buffer.data() + pos, sizeof(length));
+        pos += sizeof(length);
+        if(length > buffer.size() - pos)
+        {
+            return false;
+        }
+        res.emplace_back(std::string(buffer.data() + pos, length));
+        pos += length;
+    }
+    if(pos != buffer.size() || res.size() != chunk.count)
+    {
+        return false;
+    }
+    values = std::move(res);
+    return true;
+}
+
+// the chunk stays spilled if it can't be read back
+bool ValueStack::page_in(StackChunk& chunk)
+{
+    if(!read_chunk(chunk, chunk.values))
+    {
+        return false;
+    }
+    ftruncate(spill_fd, chunk.offset);
+    chunk.spilled = false;
+    resident_bytes += chunk.bytes;
+    first_resident = chunks.size() - 1;
+    peek_chunk = NO_CHUNK;
+    return true;
+}
+
+// the top chunk is never spilled so pushes and pops near the top stay in memory
+void ValueStack::spill_cold()
+{
+    if(limit_version != environment.version())
+    {
+        memory_limit = get_stack_limit(environment);
+        limit_version = environment.version();
+    }
+    while(resident_bytes > memory_limit && first_resident + 1 < chunks.size())
+    {
+        if(!spill(chunks[first_resident]))
+        {
+            break;
+        }
+        first_resident++;
+    }
+}
+
+// a chunk below the top is always full, so a new chunk is started rather than adding to a spilled one
+StackChunk& ValueStack::push_chunk()
+{
+    if(chunks.size() == 0 || chunks.back().count == STACK_CHUNK_SIZE)
+    {
+        chunks.emplace_back((StackChunk){.values = {}, .count = 0, .bytes = 0, .spilled = false, .offset = 0, .file_length = 0});
+        chunks.back().values.reserve(STACK_CHUNK_SIZE);
+    }
+    return chunks.back();
+}
+
+void ValueStack::push(const Value& value)
+{
+    StackChunk& top = push_chunk();
+    top.values.emplace_back(value);
+    top.count++;
+    top.bytes += value_cost(value);
+    resident_bytes += value_cost(value);
+    num_values++;
+    spill_cold();
+}
+
+// values are moved onto the stack a chunk at a time, values[0] ending up deepest
+void ValueStack::push_many(std::vector<Value>& values)
+{
+    std::size_t pushed = 0;
+    while(pushed < values.size())
+    {
+        StackChunk& top = push_chunk();
+        std::size_t count = std::min(values.size() - pushed, STACK_CHUNK_SIZE - top.count);
+        std::size_t bytes = 0;
+        for(std::size_t i = pushed; i < pushed + count; i++)
+        {
+            bytes += value_cost(values[i]);
+        }
+        top.values.insert(top.values.end(), std::make_move_iterator(values.begin() + pushed), std::make_move_iterator(values.begin() + pushed + count));
+        top.count += count;
+        top.bytes += bytes;
+        resident_bytes += bytes;
+        num_values += count;
+        pushed += count;
+        spill_cold();
+    }
+    values.clear();
+}
+
+// spilled chunks are only read back once popping reaches them
+bool ValueStack::pop(Value& value)
+{
+    if(num_values == 0 || (chunks.back().spilled && !page_in(chunks.back())))
+    {
+        return false;
+    }
+    StackChunk& top = chunks.back();
+    value = std::move(top.values.back());
+    top.values.pop_back();
+    top.count--;
+    top.bytes -= value_cost(value);
+    resident_bytes -= value_cost(value);
+    num_values--;
+    if(top.count == 0)
+    {
+        chunks.pop_back();
+    }
+    return true;
+}
+
+// the top count values are moved into values a chunk at a time, values.back() being the old top
+// if a spilled chunk can't be read back the values taken so far are returned and the stack is left as it was
+bool ValueStack::pop_many(std::size_t count, std::vector<Value>& values)
+{
+    if(count > num_values)
+    {
+        return false;
+    }
+    values.resize(count);
+    std::size_t remaining = count;
+    while(remaining > 0)
+    {
+        if(chunks.back().spilled && !page_in(chunks.back()))
+        {
+            std::vector<Value> taken(std::make_move_iterator(values.begin() + remaining), std::make_move_iterator(values.end()));
+            push_many(taken);
+            values.clear();
+            return false;
+        }
+        StackChunk& top = chunks.back();
+        std::size_t taking = std::min(remaining, top.count);
+        std::size_t bytes = 0;
+        for(std::size_t i = top.count - taking; i < top.count; i++)
+        {
+            bytes += value_cost(top.values[i]);
+        }
+        std::move(top.values.end() - taking, top.values.end(), values.begin() + (remaining - taking));
+        top.values.resize(top.count - taking);
+        top.count -= taking;
+        top.bytes -= bytes;
+        resident_bytes -= bytes;
+        num_values -= taking;
+        remaining -= taking;
+        if(top.count == 0)
+        {
+            chunks.pop_back();
+        }
+    }
+    return true;
+}
+
+std::size_t ValueStack::size() const
+{
+    return num_values;
+}
+
+// index counts from the bottom of the stack
+// the most recently read spilled chunk is kept so walking the whole stack reads each chunk once
+bool ValueStack::peek(std::size_t index, Value& value)
+{
+    if(index >= num_values)
+    {
+        return false;
+    }
+    std::size_t chunk_index = index / STACK_CHUNK_SIZE;
+    std::size_t offset = index % STACK_CHUNK_SIZE;
+    const StackChunk& chunk = chunks[chunk_index];
+    if(!chunk.spilled)
+    {
+        value = chunk.values[offset];
+        return true;
+    }
+    if(peek_chunk != chunk_index)
+    {
+        if(!read_chunk(chunk, peek_values))
+        {
+            peek_chunk = NO_CHUNK;
+            return false;
+        }
+        peek_chunk = chunk_index;
+    }
+    value = peek_values[offset];
+    return true;
+}
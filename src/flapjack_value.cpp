@@ -0,0 +1,16 @@
+#include <flapjack_value.h>
+
+// every empty value shares one string so clearing a register never allocates
+static const std::shared_ptr<const std::string> empty_text = std::make_shared<const std::string>();
+
+Value::Value() : text(empty_text)
+{
+}
+
+Value::Value(std::string text) : text(text.length() == 0 ? empty_text : std::make_shared<const std::string>(std::move(text)))
+{
+}
+
+Value::Value(const char* text) : Value(std::string(text))
+{
+}
@@ -0,0 +1,272 @@
+#include <flapjack_walk.h>
+#include <flapjack_dir.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <algorithm>
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MAX_WALK_THREADS 16
+#define WALK_OUTPUT_BUFFER (64 * 1024)
+
+// directories are queued as paths relative to the root's fd so changing directory mid walk can't redirect it
+struct WalkQueue
+{
+    std::mutex lock;
+    std::deque<std::string> dirs;
+};
+
+struct WalkState
+{
+    // polled by the workers so Ctrl-C stops the walk
+    TerminalIO* terminal;
+    int root_fd;
+    std::string root;
+    std::string pattern;
+    int out_fd;
+    std::mutex out_lock;
+    std::vector<WalkQueue> queues;
+    // directories queued or being read, the walk is over once this drops to 0
+    std::atomic<std::size_t> pending;
+    // directories sitting in a queue, workers with nothing to do sleep on idle until this or pending changes
+    std::atomic<std::size_t> queued;
+    std::atomic<std::size_t> idle_workers;
+    std::mutex idle_lock;
+    std::condition_variable idle;
+    std::atomic<std::size_t> matched;
+    std::atomic<std::size_t> unreadable;
+};
+
+// owners work depth first from the back of their queue while thieves take the oldest, shallowest directories
+// from the front, which tend to hold the most work
+static bool take_dir(WalkState& state, std::size_t worker, std::string& dir)
+{
+    WalkQueue& own = state.queues[worker];
+    {
+        std::lock_guard<std::mutex> guard(own.lock);
+        if(own.dirs.size() > 0)
+        {
+            dir = std::move(own.dirs.back());
+            own.dirs.pop_back();
+            state.queued--;
+            return true;
+        }
+    }
+    for(std::size_t i = 1; i < state.queues.size(); i++)
+    {
+        WalkQueue& victim = state.queues[(worker + i) % state.queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if(victim.dirs.size() > 0)
+        {
+            dir = std::move(victim.dirs.front());
+            victim.dirs.pop_front();
+            state.queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+// after Ctrl-C every directory not yet started is dropped, the walk ends once those being read are done
+static void drain_queues(WalkState& state)
+{
+    std::size_t removed = 0;
+    for(WalkQueue& queue : state.queues)
+    {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        removed += queue.dirs.size();
+        queue.dirs.clear();
+    }
+    if(removed == 0)
+    {
+        return;
+    }
+    state.queued -= removed;
+    if((state.pending -= removed) == 0)
+    {
+        std::lock_guard<std::mutex> guard(state.idle_lock);
+        state.idle.notify_all();
+    }
+}
+
+static void flush_output(WalkState& state, std::string& buffer)
+{
+    std::lock_guard<std::mutex> guard(state.out_lock);
+    std::size_t written = 0;
+    while(written < buffer.length())
+    {
+        ssize_t amount = write(state.out_fd, buffer.data() + written, buffer.length() - written);
+        if(amount < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(amount <= 0)
+        {
+            break;
+        }
+        written += amount;
+    }
+    buffer.clear();
+}
+
+// the directory is listed with the same getdents64 reader as '_', each worker reusing one listing and its buffer
+static void read_dir(WalkState& state, std::size_t worker, const std::string& dir, DirListing& listing, std::string& buffer, std::vector<std::string>& matches)
+{
+    if(!listing.read_at(state.root_fd, dir.length() > 0 ? dir : "."))
+    {
+        state.unreadable++;
+        return;
+    }
+    std::vector<std::string> subdirs;
+    for(std::size_t i = 0; i < listing.size(); i++)
+    {
+        const char* name = listing.name(i);
+        std::string relative = dir.length() > 0 ? dir + "/" + name : name;
+        bool is_dir = listing.type(i) == DT_DIR;
+        if(listing.type(i) == DT_UNKNOWN)
+        {
+            struct stat info;
+            is_dir = fstatat(listing.fd(), name, &info, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(info.st_mode);
+        }
+        if(state.pattern.length() == 0 || fnmatch(state.pattern.c_str(), name, 0) == 0)
+        {
+            state.matched++;
+            std::string path = state.root + "/" + relative;
+            if(state.out_fd >= 0)
+            {
+                buffer += path;
+                buffer += '\n';
+                if(buffer.length() >= WALK_OUTPUT_BUFFER)
+                {
+                    flush_output(state, buffer);
+                }
+            }
+            else
+            {
+                matches.emplace_back(std::move(path));
+            }
+        }
+        if(is_dir)
+        {
+            subdirs.emplace_back(std::move(relative));
+        }
+    }
+    if(subdirs.size() > 0)
+    {
+        state.pending += subdirs.size();
+        WalkQueue& own = state.queues[worker];
+        {
+            std::lock_guard<std::mutex> guard(own.lock);
+            for(std::string& subdir : subdirs)
+            {
+                own.dirs.emplace_back(std::move(subdir));
+            }
+        }
+        // queued is only raised once the directories can be taken so a woken worker never finds nothing
+        state.queued += subdirs.size();
+        if(state.idle_workers.load() > 0)
+        {
+            std::lock_guard<std::mutex> guard(state.idle_lock);
+            state.idle.notify_all();
+        }
+    }
+}
+
+static void walk_worker(WalkState& state, std::size_t worker, std::vector<std::string>& matches)
+{
+    DirListing listing;
+    std::string buffer;
+    std::string dir;
+    while(true)
+    {
+        if(state.terminal->should_quit())
+        {
+            drain_queues(state);
+        }
+        if(take_dir(state, worker, dir))
+        {
+            read_dir(state, worker, dir, listing, buffer, matches);
+            if(--state.pending == 0)
+            {
+                std::lock_guard<std::mutex> guard(state.idle_lock);
+                state.idle.notify_all();
+            }
+            continue;
+        }
+        // everything left is being read by other workers which may still queue more
+        // idle_workers is raised before queued is checked and queued before idle_workers,
+        // so either this worker sees the new directories or whoever queued them wakes it
+        std::unique_lock<std::mutex> guard(state.idle_lock);
+        state.idle_workers++;
+        state.idle.wait(guard, [&state]{ return state.pending.load() == 0 || state.queued.load() > 0; });
+        state.idle_workers--;
+        if(state.pending.load() == 0)
+        {
+            break;
+        }
+    }
+    if(buffer.length() > 0)
+    {
+        flush_output(state, buffer);
+    }
+}
+
+long walk_tree(TerminalIO& terminal, const std::string& root, const std::string& pattern, int out_fd, std::vector<std::string>& matches)
+{
+    WalkState state;
+    state.terminal = &terminal;
+    state.root_fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(state.root_fd < 0)
+    {
+        terminal.print_error("Error opening directory %s\r\n", root.c_str());
+        return -1;
+    }
+    state.root = root;
+    // avoid doubled separators in results when the root is given with a trailing '/'
+    while(state.root.length() > 1 && state.root.back() == '/')
+    {
+        state.root.pop_back();
+    }
+    if(state.root == "/")
+    {
+        state.root = "";
+    }
+    state.pattern = pattern;
+    state.out_fd = out_fd;
+    std::size_t num_threads = std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, MAX_WALK_THREADS);
+    state.queues = std::vector<WalkQueue>(num_threads);
+    state.queues[0].dirs.emplace_back("");
+    state.pending = 1;
+    state.queued = 1;
+    state.idle_workers = 0;
+    state.matched = 0;
+    state.unreadable = 0;
+    std::vector<std::vector<std::string>> worker_matches(num_threads);
+    std::vector<std::thread> workers;
+    for(std::size_t i = 1; i < num_threads; i++)
+    {
+        workers.emplace_back(walk_worker, std::ref(state), i, std::ref(worker_matches[i]));
+    }
+    walk_worker(state, 0, worker_matches[0]);
+    for(std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    close(state.root_fd);
+    for(std::vector<std::string>& found : worker_matches)
+    {
+        std::move(found.begin(), found.end(), std::back_inserter(matches));
+    }
+    if(state.unreadable > 0)
+    {
+        terminal.print_error("Unable to read %zu directories under %s\r\n", state.unreadable.load(), root.c_str());
+    }
+    return state.matched;
+}
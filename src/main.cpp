@@ -1,24 +1,50 @@
 #include <terminal.h>
 #include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <signal.h>
 
 int main(int argc, const char* argv[])
 {
     if(argc == 0)
     {
-        std::fprintf(stderr, "Usage: flapjack [file]\r\nNo arguments were provided when the first should be this executable\r\n");
+        std::fprintf(stderr, "Usage: flapjack [-p] [file | -c code]\r\nNo arguments were provided when the first should be this executable\r\n");
     }
-    else if(argc > 2)
+    int arg = 1;
+    bool profile = arg < argc && std::strcmp(argv[arg], "-p") == 0;
+    if(profile)
     {
-        std::fprintf(stderr, "Usage: %s [file]\r\n", argv[0]);
+        arg++;
     }
-    Terminal terminal(argv[0]);
-    if(argc == 1)
+    bool code = arg < argc && std::strcmp(argv[arg], "-c") == 0;
+    int num_args = argc - arg;
+    if((code && num_args != 2) || (!code && num_args > 1))
     {
-        terminal.run_cmdline();
+        std::fprintf(stderr, "Usage: %s [-p] [file | -c code]\r\n", argv[0]);
+        return 1;
+    }
+    Terminal terminal(argc > 0 ? argv[0] : "flapjack");
+    if(profile)
+    {
+        terminal.start_profiling();
+    }
+    if(code)
+    {
+        terminal.run_code(argv[arg + 1]);
+    }
+    else if(num_args == 1)
+    {
+        terminal.run_file(argv[arg]);
+    }
+    else if(!isatty(STDIN_FILENO))
+    {
+        terminal.run_stream(STDIN_FILENO);
     }
     else
     {
-        terminal.run_file(argv[1]);
+        terminal.run_cmdline();
     }
-    return 0;
+    terminal.report_profile();
+    // like other shells, a script stopped by Ctrl-C exits with 128 plus the signal number
+    return terminal.interrupted() ? 128 + SIGINT : 0;
 }
@@ -1,70 +1,201 @@
 #include <terminal.h>
 #include <cstdio>
+#include <cstring>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
 #include <flapjack_commands.h>
 
-Terminal::Terminal(const std::string& call_name) : terminal_io(), parser()
+// piped scripts are read in chunks of this size, growing only for a single line longer than it
+#define STREAM_BUFFER_SIZE (64 * 1024)
+
+Terminal::Terminal(const std::string& call_name) : terminal_io(), parser(), history(), completer(parser.executable_cache())
 {
-    current_dir = update_current_dir(current_dir);
-    if(setenv("SHELL", call_name.c_str(), true) != 0)
+    current_dir = update_current_dir(parser.environment(), current_dir);
+    if(!parser.environment().set("SHELL", call_name))
     {
         terminal_io.print_error("Unable to overwrite 'SHELL' environment variable\r\n");
     }
 }
 
+void Terminal::add_lines(const char* start, const char* end)
+{
+    while(start < end)
+    {
+        const char* newline = static_cast<const char*>(std::memchr(start, '\n', end - start));
+        if(newline == NULL)
+        {
+            newline = end;
+        }
+        parser.add_line(std::string_view(start, newline - start));
+        start = newline + 1;
+    }
+}
+
+// FLAPJACK_HISTORY names the history file, by default it is ~/.flapjack_history
+static std::string history_path(const Environment& environment)
+{
+    const std::string* path = environment.get("FLAPJACK_HISTORY");
+    if(path != NULL)
+    {
+        return *path;
+    }
+    const std::string* home = environment.get("HOME");
+    if(home == NULL)
+    {
+        return "";
+    }
+    return *home + "/.flapjack_history";
+}
+
 void Terminal::run_cmdline()
 {
+    std::string path = history_path(parser.environment());
+    if(path.length() > 0)
+    {
+        history.load(path);
+    }
     while(true)
     {
-        std::string line = terminal_io.get_line(current_dir, lines);
-        lines.emplace_back(line);
-        parser.parse(terminal_io, current_dir, lines, lines.size() - 1);
+        std::string line = terminal_io.get_line(current_dir, history, completer);
+        history.add(line);
+        parser.add_line(line);
+        // Ctrl-C stops the line being run and returns to the prompt, so one pressed at the prompt is forgotten
+        terminal_io.clear_quit();
+        if(parser.verify(terminal_io, parser.size() - 1))
+        {
+            parser.parse(terminal_io, current_dir, parser.size() - 1);
+        }
+    }
+}
+
+// a whole script is checked before any of it runs and isn't run at all if anything is wrong
+void Terminal::run_verified()
+{
+    if(!parser.verify(terminal_io, 0))
+    {
+        terminal_io.flush();
+        std::exit(1);
     }
+    parser.parse(terminal_io, current_dir, 0);
 }
 
+// the script is mapped rather than read and each line is compiled straight from the mapping
+// so no copy of the file or its lines is made and the mapping is released before running
 void Terminal::run_file(const std::string& file_name)
 {
-    std::FILE* file = fopen(file_name.c_str(), "r");
-    if(file == NULL)
+    int file = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+    if(file == -1)
     {
         terminal_io.print_error("Unable to open file '%s'\r\n", file_name.c_str());
+        terminal_io.flush();
         std::exit(1);
     }
     struct stat file_state;
-    if(stat(file_name.c_str(), &file_state) == -1)
+    if(fstat(file, &file_state) == -1)
     {
         terminal_io.print_error("Unable to get size of file '%s'\r\n", file_name.c_str());
-        fclose(file);
+        close(file);
+        terminal_io.flush();
         std::exit(1);
     }
-    std::string buffer;
-    buffer.reserve(file_state.st_size);
-    if(std::fread(buffer.data(), sizeof(char), file_state.st_size / sizeof(char), file) != file_state.st_size / sizeof(char))
+    std::size_t length = file_state.st_size;
+    if(length > 0)
     {
-        terminal_io.print_error("Error reading file '%s'\r\n", file_name.c_str());
-        fclose(file);
-        std::exit(1);
+        void* mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, file, 0);
+        if(mapping == MAP_FAILED)
+        {
+            terminal_io.print_error("Error reading file '%s'\r\n", file_name.c_str());
+            close(file);
+            terminal_io.flush();
+            std::exit(1);
+        }
+        madvise(mapping, length, MADV_SEQUENTIAL);
+        const char* start = static_cast<const char*>(mapping);
+        add_lines(start, start + length);
+        munmap(mapping, length);
     }
-    std::vector<std::string> lines;
-    std::string line = "";
-    for(std::size_t i = 0; i < buffer.length(); i++)
+    close(file);
+    run_verified();
+}
+
+void Terminal::run_code(const std::string& code)
+{
+    add_lines(code.data(), code.data() + code.length());
+    run_verified();
+}
+
+// lines are run as soon as they arrive, like at the prompt, so labels can only be jumped back to
+// a malformed line stops the script like it would in a file, though lines read before it may already have run
+// Ctrl-C stops the script rather than just the lines that have arrived so far
+void Terminal::run_stream(int fd)
+{
+    std::vector<char> buffer(STREAM_BUFFER_SIZE);
+    std::size_t length = 0;
+    while(!terminal_io.should_quit())
     {
-        if(buffer[i] == '\n')
+        if(length == buffer.size())
+        {
+            buffer.resize(buffer.size() * 2);
+        }
+        ssize_t num_read = read(fd, buffer.data() + length, buffer.size() - length);
+        if(num_read == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if(num_read <= 0)
         {
-            if(line.length() > 0)
-            {
-                lines.emplace_back(line);
-                line = "";    
-            }
+            break;
         }
-        else
+        length += num_read;
+        const char* start = buffer.data();
+        const char* last_newline = static_cast<const char*>(memrchr(start, '\n', length));
+        if(last_newline != NULL)
         {
-            line += buffer[i];
+            std::size_t ip = parser.size();
+            add_lines(start, last_newline);
+            run_stream_lines(ip);
+            length -= (last_newline + 1) - start;
+            std::memmove(buffer.data(), last_newline + 1, length);
         }
     }
-    if(line.length() > 0)
+    if(length > 0 && !terminal_io.should_quit())
+    {
+        std::size_t ip = parser.size();
+        add_lines(buffer.data(), buffer.data() + length);
+        run_stream_lines(ip);
+    }
+}
+
+void Terminal::run_stream_lines(std::size_t ip)
+{
+    if(!parser.verify(terminal_io, ip))
     {
-        lines.emplace_back(line);
+        terminal_io.flush();
+        std::exit(1);
     }
-    parser.parse(terminal_io, current_dir, lines, 0);
+    parser.parse(terminal_io, current_dir, ip);
+    terminal_io.flush();
+}
+
+bool Terminal::interrupted()
+{
+    return terminal_io.should_quit();
+}
+
+std::size_t Terminal::instructions_executed() const
+{
+    return parser.instructions_executed();
+}
+
+void Terminal::start_profiling()
+{
+    parser.start_profiling();
+}
+
+void Terminal::report_profile()
+{
+    parser.report_profile(terminal_io);
 }